@@ -5,6 +5,8 @@ import CompilerPluginSupport
 import Foundation
 
 let buildDynamic = ProcessInfo.processInfo.environment["NODE_SWIFT_BUILD_DYNAMIC"] == "1"
+// Builds the JSC shim with per-call stats (see js_native_api_javascriptcore.cc)
+let jscStats = ProcessInfo.processInfo.environment["NAPI_JSC_STATS"] == "1"
 
 let package = Package(
     name: "node-swift",
@@ -34,6 +36,7 @@ let package = Package(
         .systemLibrary(name: "CNodeAPI"),
         .target(
             name: "CNodeJSC",
+            cxxSettings: jscStats ? [.define("NAPI_JSC_STATS", to: "1")] : [],
             linkerSettings: [
                 .linkedFramework("JavaScriptCore"),
             ]
@@ -63,7 +66,8 @@ let package = Package(
         ),
         .testTarget(
             name: "NodeJSCTests",
-            dependencies: ["NodeJSC", "NodeAPI"]
+            dependencies: ["NodeJSC", "NodeAPI", "CNodeJSC"],
+            swiftSettings: jscStats ? [.define("NAPI_JSC_STATS")] : []
         ),
         .testTarget(
             name: "NodeAPIMacrosTests",
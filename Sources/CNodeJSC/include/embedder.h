@@ -16,6 +16,29 @@ typedef struct napi_executor {
   napi_executor_dispatch_async dispatch_async;
 } napi_executor;
 
+typedef struct napi_executor_task {
+  void (*fn)(void *);
+  void *arg;
+} napi_executor_task;
+
+// Tasks must run in order. The array is only valid for the duration of the
+// call.
+typedef void (*napi_executor_dispatch_batch)(void *, const napi_executor_task *, size_t);
+typedef void (*napi_executor_drain_microtasks)(void *);
+
+// Extends napi_executor. Tasks that the shim posts while it's running a task
+// are collected and handed over in a single dispatch_batch call.
+typedef struct napi_executor_v2 {
+  uint64_t version; // should be 2
+  void *context;
+  napi_executor_free free;
+  napi_executor_assert_current assert_current;
+  napi_executor_dispatch_async dispatch_async;
+  napi_executor_dispatch_batch dispatch_batch;
+  // Optional. Called after each batch of tasks the shim runs.
+  napi_executor_drain_microtasks drain_microtasks;
+} napi_executor_v2;
+
 #ifdef __cplusplus
 #define NAPI_JSC_EXTERN_C extern "C"
 #else
@@ -23,4 +46,115 @@ typedef struct napi_executor {
 #endif
 
 NAPI_JSC_EXTERN_C napi_env napi_env_jsc_create(JSGlobalContextRef context, napi_executor executor);
+NAPI_JSC_EXTERN_C napi_env napi_env_jsc_create_v2(JSGlobalContextRef context, napi_executor_v2 executor);
+// Deletion is deferred until the env has no strong references, threadsafe
+// functions or async work left. Deleting an env finalizes its remaining
+// threadsafe functions and runs the native finalizers of objects that are
+// still alive, since the objects can outlive it.
 NAPI_JSC_EXTERN_C void napi_env_jsc_delete(napi_env env);
+
+// A pool of contexts sharing one JSContextGroup, for hosts that create many
+// short-lived envs. Spare contexts are created ahead of time so that creating
+// an env doesn't have to, and each deleted env's context is replaced with a
+// fresh one in the same group on a thread of the pool's own.
+typedef struct napi_jsc_context_pool__* napi_jsc_context_pool;
+
+typedef struct napi_jsc_context_pool_stats {
+  uint64_t envs_created;
+  uint64_t envs_deleted;
+  size_t spare_contexts;
+  uint64_t mean_creation_ns;
+  uint64_t max_creation_ns;
+  // Spare contexts created by the pool, off the JS thread once it's running.
+  uint64_t contexts_replenished;
+  uint64_t mean_replenish_ns;
+  uint64_t max_replenish_ns;
+} napi_jsc_context_pool_stats;
+
+NAPI_JSC_EXTERN_C napi_jsc_context_pool napi_jsc_context_pool_create(size_t spare_contexts);
+// The pool stays alive until its envs have been deleted.
+NAPI_JSC_EXTERN_C void napi_jsc_context_pool_release(napi_jsc_context_pool pool);
+NAPI_JSC_EXTERN_C void napi_jsc_context_pool_get_stats(napi_jsc_context_pool pool, napi_jsc_context_pool_stats* result);
+// The group the pool's contexts are in. Other contexts created in it share
+// their VM and heap.
+NAPI_JSC_EXTERN_C JSContextGroupRef napi_jsc_context_pool_get_group(napi_jsc_context_pool pool);
+NAPI_JSC_EXTERN_C napi_env napi_env_jsc_create_pooled(napi_jsc_context_pool pool, napi_executor_v2 executor);
+
+typedef struct napi_jsc_env_memory_stats {
+  uint64_t creation_ns;
+  int64_t external_memory; // as reported by napi_adjust_external_memory
+  size_t ref_table_bytes;
+  size_t strong_refs;
+  size_t arraybuffer_pool_bytes;
+} napi_jsc_env_memory_stats;
+
+// Native memory held by the env itself. The JS heap is shared by every
+// context in a group and isn't broken down per env.
+NAPI_JSC_EXTERN_C void napi_env_jsc_get_memory_stats(napi_env env, napi_jsc_env_memory_stats* result);
+
+typedef struct napi_jsc_script_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  size_t count; // scripts currently cached
+} napi_jsc_script_cache_stats;
+
+// Counters for the compiled-script cache used by napi_run_script.
+NAPI_JSC_EXTERN_C void napi_env_jsc_get_script_cache_stats(napi_env env, napi_jsc_script_cache_stats* result);
+
+typedef struct napi_jsc_property_key_stats {
+  uint64_t pointer_hits; // found by the address of the name
+  uint64_t name_hits; // found by the content of the name
+  uint64_t misses;
+  size_t count; // keys currently cached
+} napi_jsc_property_key_stats;
+
+// Counters for the cache of property names behind the named-property
+// functions, napi_define_properties and node_api_create_property_key_*.
+NAPI_JSC_EXTERN_C void napi_env_jsc_get_property_key_stats(napi_env env, napi_jsc_property_key_stats* result);
+
+typedef struct napi_jsc_arraybuffer_pool_stats {
+  uint64_t hits;
+  uint64_t misses;
+  size_t bytes_cached; // freed backing stores waiting for reuse
+} napi_jsc_arraybuffer_pool_stats;
+
+// Counters for the pool behind napi_create_arraybuffer and napi_create_buffer.
+NAPI_JSC_EXTERN_C void napi_env_jsc_get_arraybuffer_pool_stats(napi_env env, napi_jsc_arraybuffer_pool_stats* result);
+
+// Threads running async work for every env in the process.
+NAPI_JSC_EXTERN_C size_t napi_jsc_async_work_threads(void);
+
+// Numbered per-env data slots, for libraries that need per-env state on
+// every call without going through a hash map. A library claims a slot once
+// per process and then uses it with any env. Slot 0 is reserved for
+// napi_set_instance_data. Finalizers run when the env is deleted.
+#define NAPI_JSC_INSTANCE_DATA_SLOTS 16
+
+// Same signature as napi_finalize.
+typedef void (*napi_jsc_finalize)(napi_env env, void* data, void* hint);
+
+// Returns false once all slots are claimed.
+NAPI_JSC_EXTERN_C bool napi_jsc_claim_instance_data_slot(uint32_t* slot);
+// Like napi_set_instance_data, replacing data doesn't finalize the old data.
+// Slots 0 and NAPI_JSC_INSTANCE_DATA_SLOTS and above are invalid: setting one
+// returns false and getting one returns NULL.
+NAPI_JSC_EXTERN_C bool napi_env_jsc_set_instance_data_slot(napi_env env, uint32_t slot, void* data, napi_jsc_finalize finalize_cb, void* finalize_hint);
+NAPI_JSC_EXTERN_C void* napi_env_jsc_get_instance_data_slot(napi_env env, uint32_t slot);
+
+#define NAPI_JSC_STATS_BUCKETS 32
+
+typedef struct napi_jsc_call_stats {
+  const char* name; // the function's name, e.g. "napi_get_named_property"
+  uint64_t calls;
+  uint64_t total_ns;
+  // histogram[n] counts calls that took [2^n, 2^(n+1)) ns. The first bucket
+  // also counts 0 ns and the last everything longer.
+  uint64_t histogram[NAPI_JSC_STATS_BUCKETS];
+} napi_jsc_call_stats;
+
+// Per-function call counts and latencies, for shims built with
+// NAPI_JSC_STATS=1. Otherwise there's nothing to report and this returns 0.
+// Counts are kept per thread and cover every env in the process, so there's
+// no env to pass. Writes up to capacity entries for functions that have been
+// called, and returns how many there are.
+NAPI_JSC_EXTERN_C size_t napi_jsc_get_call_stats(napi_jsc_call_stats* entries, size_t capacity);
@@ -4,20 +4,38 @@
 #include "../CNodeAPI/vendored/node_api.h"
 #include "embedder.h"
 #include <mutex>
+#include <optional>
+#include <atomic>
+#include <condition_variable>
 #include <unordered_set>
 #include <unordered_map>
+#include <deque>
 #include <list>
+#include <memory>
 #include <thread>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <functional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <locale>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #define RETURN_STATUS_IF_FALSE(env, condition, status) \
   do {                                                 \
     if (!(condition)) {                                \
@@ -51,6 +69,254 @@
     if (status != napi_ok) return status; \
   } while (0)
 
+// The vendored headers either predate these or only declare them under
+// NAPI_EXPERIMENTAL, which would also change the NAPI_VERSION that
+// napi_get_version reports.
+extern "C" {
+  napi_status node_api_create_external_string_latin1(napi_env env,
+                                                     char* str,
+                                                     size_t length,
+                                                     napi_finalize finalize_callback,
+                                                     void* finalize_hint,
+                                                     napi_value* result,
+                                                     bool* copied);
+  napi_status node_api_create_external_string_utf16(napi_env env,
+                                                    char16_t* str,
+                                                    size_t length,
+                                                    napi_finalize finalize_callback,
+                                                    void* finalize_hint,
+                                                    napi_value* result,
+                                                    bool* copied);
+  napi_status node_api_create_property_key_latin1(napi_env env,
+                                                  const char* str,
+                                                  size_t length,
+                                                  napi_value* result);
+  napi_status node_api_create_property_key_utf8(napi_env env,
+                                                const char* str,
+                                                size_t length,
+                                                napi_value* result);
+  napi_status node_api_create_property_key_utf16(napi_env env,
+                                                 const char16_t* str,
+                                                 size_t length,
+                                                 napi_value* result);
+}
+
+// Private JavaScriptCore SPI from JSWeakObjectMapRefPrivate.h,
+// JSBasePrivate.h and JSScriptRefPrivate.h. The system framework exports it; it isn't in the public
+// headers. A weak map is owned by the global object of the context it was
+// created in. Its entries are cleared by the collector itself, so it never
+// hands out a dead object.
+extern "C" {
+  void JSReportExtraMemoryCost(JSContextRef ctx, size_t size);
+
+  typedef struct OpaqueJSScript* JSScriptRef;
+  JSScriptRef JSScriptCreateFromString(JSContextGroupRef contextGroup, JSStringRef url, int startingLineNumber, JSStringRef source, JSStringRef* errorMessage, int* errorLine);
+  void JSScriptRelease(JSScriptRef script);
+  JSValueRef JSScriptEvaluate(JSContextRef ctx, JSScriptRef script, JSValueRef thisValue, JSValueRef* exception);
+
+  typedef struct OpaqueJSWeakObjectMap* JSWeakObjectMapRef;
+  typedef void (*JSWeakMapDestroyedCallback)(JSWeakObjectMapRef map, void* data);
+  JSWeakObjectMapRef JSWeakObjectMapCreate(JSContextRef ctx, void* data, JSWeakMapDestroyedCallback destructor);
+  void JSWeakObjectMapSet(JSContextRef ctx, JSWeakObjectMapRef map, void* key, JSObjectRef object);
+  JSObjectRef JSWeakObjectMapGet(JSContextRef ctx, JSWeakObjectMapRef map, void* key);
+  void JSWeakObjectMapRemove(JSContextRef ctx, JSWeakObjectMapRef map, void* key);
+}
+
+// Building with NAPI_JSC_STATS=1 (e.g. `NAPI_JSC_STATS=1 swift test`, see
+// Package.swift) counts calls to each exported function and how long they took, for
+// napi_jsc_get_call_stats. Otherwise RECORD_CALL expands to nothing.
+#ifndef NAPI_JSC_STATS
+#define NAPI_JSC_STATS 0
+#endif
+
+#if NAPI_JSC_STATS
+namespace {
+  // Every thread that calls into the shim gets its own counters, which only
+  // that thread writes to. They're atomic so that a snapshot can read them
+  // from another thread, but updates are plain loads and stores rather than
+  // read-modify-writes.
+  class CallStats {
+   public:
+    static constexpr size_t max_sites = 256;
+
+    // Returns the index for a function name. Each function calls this once,
+    // from a function-local static.
+    static uint32_t Site(const char* name) {
+      Registry& registry{Shared()};
+      std::lock_guard lock{registry.mutex};
+      // Counters are sized for max_sites, so going past it would write out
+      // of bounds. Raise the limit instead.
+      if (registry.names.size() >= max_sites) {
+        std::fprintf(stderr, "NAPI_JSC_STATS: more than %zu call sites (at %s)\n", max_sites, name);
+        std::abort();
+      }
+      registry.names.push_back(name);
+      return static_cast<uint32_t>(registry.names.size() - 1);
+    }
+
+    static void Record(uint32_t site, uint64_t ns) {
+      thread_local Thread thread;
+      Counters& counters{thread.counters[site]};
+      Bump(counters.calls, 1);
+      Bump(counters.total_ns, ns);
+      // Bucket n holds latencies in [2^n, 2^(n+1)) ns, and bucket 0 also 0.
+      size_t bucket{ns == 0 ? 0 : static_cast<size_t>(63 - __builtin_clzll(ns))};
+      Bump(counters.histogram[std::min<size_t>(bucket, NAPI_JSC_STATS_BUCKETS - 1)], 1);
+    }
+
+    static size_t Snapshot(napi_jsc_call_stats* entries, size_t capacity) {
+      Registry& registry{Shared()};
+      std::lock_guard lock{registry.mutex};
+      size_t count{0};
+      for (size_t site = 0; site < registry.names.size(); site++) {
+        napi_jsc_call_stats totals{registry.retired[site]};
+        for (const Thread* thread : registry.threads) {
+          Add(totals, thread->counters[site]);
+        }
+        if (totals.calls == 0) {
+          continue;
+        }
+        if (count < capacity) {
+          entries[count] = totals;
+          entries[count].name = registry.names[site];
+        }
+        count++;
+      }
+      return count;
+    }
+
+   private:
+    struct Counters {
+      std::atomic<uint64_t> calls;
+      std::atomic<uint64_t> total_ns;
+      std::atomic<uint64_t> histogram[NAPI_JSC_STATS_BUCKETS];
+    };
+
+    struct Thread {
+      Thread() : counters{new Counters[max_sites]{}} {
+        Registry& registry{Shared()};
+        std::lock_guard lock{registry.mutex};
+        registry.threads.push_back(this);
+      }
+
+      // Keeps the counts of threads that have exited.
+      ~Thread() {
+        Registry& registry{Shared()};
+        std::lock_guard lock{registry.mutex};
+        for (size_t site = 0; site < max_sites; site++) {
+          Add(registry.retired[site], counters[site]);
+        }
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+      }
+
+      std::unique_ptr<Counters[]> counters;
+    };
+
+    struct Registry {
+      std::mutex mutex;
+      std::vector<const char*> names;
+      std::vector<const Thread*> threads;
+      napi_jsc_call_stats retired[max_sites]{};
+    };
+
+    // Leaked so that it outlives the thread_local counters of any thread.
+    static Registry& Shared() {
+      static Registry* registry{new Registry};
+      return *registry;
+    }
+
+    static void Bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+      counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static void Add(napi_jsc_call_stats& totals, const Counters& counters) {
+      totals.calls += counters.calls.load(std::memory_order_relaxed);
+      totals.total_ns += counters.total_ns.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < NAPI_JSC_STATS_BUCKETS; i++) {
+        totals.histogram[i] += counters.histogram[i].load(std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // Records the time until the end of the scope it's declared in.
+  class CallTimer {
+   public:
+    explicit CallTimer(uint32_t site)
+      : _site{site}, _start{std::chrono::steady_clock::now()} {
+    }
+
+    ~CallTimer() {
+      auto elapsed{std::chrono::steady_clock::now() - _start};
+      CallStats::Record(_site, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+   private:
+    uint32_t _site;
+    std::chrono::steady_clock::time_point _start;
+  };
+}
+
+// Calls into the shim from inside another exported function (e.g.
+// napi_get_property_names, which forwards to napi_get_all_property_names)
+// count towards both.
+#define RECORD_CALL()                                                   \
+  static const uint32_t napi_jsc_call_site{CallStats::Site(__func__)}; \
+  CallTimer napi_jsc_call_timer{napi_jsc_call_site}
+#else
+#define RECORD_CALL() \
+  do {                \
+  } while (0)
+#endif
+
+// JSC's BigInt C API ships with macOS 15 and iOS 18. Older SDKs don't declare
+// it, so it's only referenced when building against a new enough one, and
+// only called after a runtime availability check.
+#if (defined(__MAC_OS_X_VERSION_MAX_ALLOWED) && __MAC_OS_X_VERSION_MAX_ALLOWED >= 150000) || \
+    (defined(__IPHONE_OS_VERSION_MAX_ALLOWED) && __IPHONE_OS_VERSION_MAX_ALLOWED >= 180000)
+#define NAPI_JSC_BIGINT_API 1
+#else
+#define NAPI_JSC_BIGINT_API 0
+#endif
+
+// JS builtins that the shim uses internally. They're looked up by name once
+// per env and kept alive until the env is deleted. See GetIntrinsic.
+enum class Intrinsic {
+  Global,
+  Object,
+  ObjectFreeze,
+  ObjectSeal,
+  ObjectPrototype,
+  ObjectPrototypeHasOwnProperty,
+  Function,
+  FunctionPrototype,
+  Symbol,
+  Error,
+  TypeError,
+  RangeError,
+  Promise,
+  DataView,
+  WeakMap,
+  WeakMapPrototype,
+  WeakMapPrototypeGet,
+  WeakMapPrototypeSet,
+  WeakMapPrototypeHas,
+  Count
+};
+
+// Values the shim evaluates from JS source, for things the C API can't
+// express directly. Compiled once per env on first use. See GetHelper.
+enum class Helper {
+  BigInt64Scratch,
+  BigUint64Scratch,
+  BigIntFromWords,
+  BigIntToWords,
+  DefineProperty,
+  PropertyNames,
+  DetachArrayBuffer,
+  IsDetachedArrayBuffer,
+  Count
+};
+
 struct napi_env__ {
 private:
   struct pairhash {
@@ -64,47 +330,803 @@ private:
 public:
   JSGlobalContextRef context{};
   JSValueRef last_exception{};
-  JSValueRef finalization_registry{};
   JSValueRef tag_map{};
   napi_extended_error_info last_error{nullptr, nullptr, 0, napi_ok};
-  std::list<napi_ref> strong_refs{};
+  // Storage for napi_refs. Slots are allocated in fixed-size chunks so that
+  // handles stay stable, and recycled through an intrusive free list. Strong
+  // values are kept alive by a single protected array, at their slot's index,
+  // instead of each being protected on its own.
+  static constexpr uint32_t ref_chunk_size = 256;
+  std::vector<std::unique_ptr<napi_ref__[]>> ref_chunks{};
+  napi_ref free_refs{};
+  JSObjectRef ref_root{};
+  size_t strong_ref_count{};
   std::unordered_map<napi_cleanup_hook, std::unordered_set<void *>> cleanup_hooks;
   std::unordered_set<void *> all_tsfns;
+  // Promises that haven't been settled yet. Their resolving functions are
+  // protected until then, or until the env is deleted.
+  std::unordered_set<napi_deferred> deferreds;
   std::unordered_set<void *> strong_tsfns;
   bool is_deleting = false;
+  // Node-style pool for small buffers: they're carved out of a shared slab
+  // ArrayBuffer instead of each getting an allocation of their own. The slab
+  // stays alive for as long as any buffer carved from it.
+  static constexpr size_t buffer_pool_size = 8 * 1024;
+  JSObjectRef buffer_pool{};
+  uint8_t* buffer_pool_data{};
+  size_t buffer_pool_offset{};
+  // Slot 0 holds napi_set_instance_data's data. The rest are claimed by
+  // libraries through napi_jsc_claim_instance_data_slot, so each gets O(1)
+  // per-env state without hashing. Finalized in deinit_refs.
+  struct instance_data {
+    void* data;
+    napi_finalize finalize_cb;
+    void* finalize_hint;
+  };
+  instance_data instance_data_slots[NAPI_JSC_INSTANCE_DATA_SLOTS]{};
+  // Native memory kept alive by JS objects, as reported through
+  // napi_adjust_external_memory.
+  std::atomic<int64_t> external_memory{0};
+
+  // Shared classes for native objects, indexed by NativeType. Objects carry
+  // their NativeInfo as private data, so one class per type is enough.
+  JSClassRef native_classes[4]{};
+  // WeakMap from wrapped objects to the holders of their WrapperInfo. See
+  // WrapperInfo::Wrap.
+  JSObjectRef wrap_map{};
+  JSValueRef intrinsics[static_cast<size_t>(Intrinsic::Count)]{};
+  JSValueRef helpers[static_cast<size_t>(Helper::Count)]{};
+  // Targets of weak napi_refs, keyed by the napi_ref. See weak_refs().
+  JSWeakObjectMapRef weak_map{};
+
+  // Callbacks posted to the JS thread from places that can't call into JS
+  // themselves, run in batches on the executor. Shared with the scheduled
+  // drain so that it stays valid if the env is deleted first.
+  struct callback_queue {
+    struct entry {
+      void (*run)(void*);
+      void* data;
+    };
+
+    std::mutex mutex;
+    std::vector<entry> entries;
+    bool scheduled = false;
+    // Cleared when the env is deleted.
+    napi_env__* env{};
+    // Native finalizers of objects that are still alive, by owner. Objects
+    // can outlive their env, so the env runs these when it's deleted. Only
+    // used by `finalizers`.
+    std::unordered_map<void*, void (*)(void*)> armed;
+
+    void drain();
+    // Registers run_now(owner) to be called if the env is deleted first.
+    void arm(void* owner, void (*run_now)(void*));
+    // Queues run(owner) in place of its armed finalizer. Returns false if
+    // the env is gone and has already run it.
+    bool post(void* owner, void (*run)(void*));
+    // Runs queued and armed finalizers until there are none left, then
+    // detaches the queue from the env.
+    void finalize_all();
+  };
+  // JSC runs finalize callbacks in the middle of a collection, where calling
+  // back into JS isn't allowed, so native finalizers are queued instead.
+  std::shared_ptr<callback_queue> finalizers{std::make_shared<callback_queue>()};
+  // Completions of async work, posted from the worker pool.
+  std::shared_ptr<callback_queue> completions{std::make_shared<callback_queue>()};
+  // Async work that's queued or running. Keeps the env alive.
+  size_t active_async_work{};
+
+  // Size-class freelists for ArrayBuffer backing stores from 64B to 16KB.
+  // Each block starts with a header pointing back at its pool, so the
+  // deallocator needs no context of its own. JSC may free backing stores after
+  // the env is gone, so every outstanding block holds a reference to the pool
+  // and a closed pool frees blocks instead of caching them.
+  struct arraybuffer_pool {
+    struct alignas(16) header {
+      arraybuffer_pool* pool;
+      size_t size_class;
+    };
+
+    static constexpr size_t min_size_shift = 6;
+    static constexpr size_t class_count = 9;
+    static constexpr size_t uncached = class_count;
+    // Per class, so that one burst of a single size can't pin everything.
+    static constexpr size_t max_cached_bytes = 256 * 1024;
+
+    static size_t class_size(size_t size_class) {
+      return size_t{1} << (size_class + min_size_shift);
+    }
+
+    static size_t size_class_for(size_t byte_length) {
+      size_t size_class{0};
+      while (size_class < class_count && class_size(size_class) < byte_length) {
+        ++size_class;
+      }
+      return size_class;
+    }
+
+    // Returns memory for byte_length bytes, or null if malloc fails.
+    void* allocate(size_t byte_length) {
+      size_t size_class{size_class_for(byte_length)};
+      header* block{};
+      if (size_class != uncached) {
+        std::lock_guard lock(mutex);
+        block = free_lists[size_class];
+        if (block != nullptr) {
+          free_lists[size_class] = *reinterpret_cast<header**>(block + 1);
+          --counts[size_class];
+          bytes_cached -= class_size(size_class);
+          ++hits;
+        } else {
+          ++misses;
+        }
+      }
+      if (block == nullptr) {
+        size_t size{size_class == uncached ? byte_length : class_size(size_class)};
+        block = static_cast<header*>(malloc(sizeof(header) + size));
+        if (block == nullptr) {
+          return nullptr;
+        }
+        block->size_class = size_class;
+      }
+      block->pool = this;
+      refs.fetch_add(1, std::memory_order_relaxed);
+      return block + 1;
+    }
+
+    // Usable as a JSTypedArrayBytesDeallocator.
+    static void deallocate(void* bytes, void* = nullptr) {
+      header* block{static_cast<header*>(bytes) - 1};
+      arraybuffer_pool* pool{block->pool};
+      size_t size_class{block->size_class};
+      bool cached{};
+      if (size_class != uncached) {
+        std::lock_guard lock(pool->mutex);
+        if (!pool->closed && (pool->counts[size_class] + 1) * class_size(size_class) <= max_cached_bytes) {
+          *reinterpret_cast<header**>(block + 1) = pool->free_lists[size_class];
+          pool->free_lists[size_class] = block;
+          ++pool->counts[size_class];
+          pool->bytes_cached += class_size(size_class);
+          cached = true;
+        }
+      }
+      if (!cached) {
+        free(block);
+      }
+      pool->release();
+    }
+
+    // Called by the env on deletion. Blocks still owned by JSC keep the pool
+    // alive until they're freed.
+    void close() {
+      {
+        std::lock_guard lock(mutex);
+        closed = true;
+        for (header*& list : free_lists) {
+          while (list != nullptr) {
+            header* next{*reinterpret_cast<header**>(list + 1)};
+            free(list);
+            list = next;
+          }
+        }
+        std::fill(std::begin(counts), std::end(counts), 0);
+        bytes_cached = 0;
+      }
+      release();
+    }
+
+    std::mutex mutex;
+    header* free_lists[class_count]{};
+    size_t counts[class_count]{};
+    size_t bytes_cached{};
+    uint64_t hits{};
+    uint64_t misses{};
+    bool closed{};
+
+   private:
+    void release() {
+      if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+      }
+    }
+
+    // One for the env plus one per outstanding block.
+    std::atomic<size_t> refs{1};
+  };
+  arraybuffer_pool* arraybuffers{new arraybuffer_pool};
+
+  // Scripts compiled by napi_run_script, evicted least recently used first.
+  // They're indexed by the length of their source and told apart with
+  // JSStringIsEqual, so that a hit never reads the source's characters,
+  // which JSC would first have to widen if it stores them with 8 bits each.
+  struct script_cache {
+    struct entry {
+      JSStringRef source;
+      JSScriptRef script;
+    };
+
+    static constexpr size_t capacity = 64;
+    // Most recently used first.
+    std::list<entry> entries;
+    std::unordered_multimap<size_t, std::list<entry>::iterator> index;
+    uint64_t hits{};
+    uint64_t misses{};
+
+    // Called by the env while its context, and with it the VM, is still
+    // alive. Scripts can't be released after that.
+    void clear() {
+      for (const entry& e : entries) {
+        JSStringRelease(e.source);
+        JSScriptRelease(e.script);
+      }
+      entries.clear();
+      index.clear();
+    }
+
+    // Returns null, and counts a miss, if source isn't cached.
+    JSScriptRef find(JSStringRef source) {
+      auto [begin, end] = index.equal_range(JSStringGetLength(source));
+      for (auto it{begin}; it != end; ++it) {
+        if (JSStringIsEqual(it->second->source, source)) {
+          ++hits;
+          entries.splice(entries.begin(), entries, it->second);
+          return it->second->script;
+        }
+      }
+      ++misses;
+      return nullptr;
+    }
+
+    // Returns null if the source doesn't parse. Only scripts that parse are
+    // cached.
+    JSScriptRef insert(JSContextRef context, JSStringRef source, JSStringRef url) {
+      JSScriptRef script{JSScriptCreateFromString(JSContextGetGroup(context), url, 1, source, nullptr, nullptr)};
+      if (script == nullptr) {
+        return nullptr;
+      }
+      if (entries.size() == capacity) {
+        erase(std::prev(entries.end()));
+      }
+      entries.push_front({JSStringRetain(source), script});
+      index.emplace(JSStringGetLength(source), entries.begin());
+      return script;
+    }
+
+   private:
+    void erase(std::list<entry>::iterator it) {
+      auto [begin, end] = index.equal_range(JSStringGetLength(it->source));
+      for (auto found{begin}; found != end; ++found) {
+        if (found->second == it) {
+          index.erase(found);
+          break;
+        }
+      }
+      JSStringRelease(it->source);
+      JSScriptRelease(it->script);
+      entries.erase(it);
+    }
+  };
+  script_cache scripts;
+
+  // Retained JSStrings for property names passed as C strings, so that the
+  // named-property APIs don't create and release one per call. Entries are
+  // keyed by their UTF-8 content and evicted least recently used first. A
+  // small direct-mapped table in front of that remembers which entry a
+  // name's address last resolved to; the content is still compared, since
+  // the caller may have reused the address for a different name.
+  struct property_key_cache {
+    struct entry {
+      std::string name;
+      JSStringRef string;
+    };
+
+    static constexpr size_t capacity = 512;
+    static constexpr size_t pointer_slots = 64;
+    // Most recently used first.
+    std::list<entry> entries;
+    // Keys point into the entries' names.
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index;
+    struct pointer_slot {
+      const char* name;
+      std::list<entry>::iterator it;
+    } by_pointer[pointer_slots]{};
+    uint64_t pointer_hits{};
+    uint64_t name_hits{};
+    uint64_t misses{};
+
+    // Called by the env before it releases its context.
+    void clear() {
+      for (const entry& e : entries) {
+        JSStringRelease(e.string);
+      }
+      entries.clear();
+      index.clear();
+      std::fill(std::begin(by_pointer), std::end(by_pointer), pointer_slot{});
+    }
+
+    // Keeps a cached string retained, so that it outlives its entry if a
+    // nested lookup (from a getter, say) evicts it while it's in use.
+    class key {
+     public:
+      explicit key(JSStringRef string)
+        : _string{JSStringRetain(string)} {
+      }
+      key(const key&) = delete;
+      key& operator=(const key&) = delete;
+      ~key() {
+        JSStringRelease(_string);
+      }
+      operator JSStringRef() const {
+        return _string;
+      }
 
-  const napi_executor executor;
+     private:
+      JSStringRef _string;
+    };
 
-  napi_env__(JSGlobalContextRef context, napi_executor executor) : context{context}, executor{executor} {
+    key get(const char* name);
+    // Strings that would be transcoded to name can pass their UTF-16 form to
+    // skip doing it again on a miss.
+    key get(std::string_view name, const JSChar* chars = nullptr, size_t length = 0);
+
+   private:
+    std::list<entry>::iterator find_or_insert(std::string_view name, const JSChar* chars, size_t length);
+    void erase(std::list<entry>::iterator it);
+  };
+  property_key_cache property_keys;
+
+  // The string napi_get_value_string_utf8 last measured, kept for the copy
+  // that usually follows. JSStringGetCharactersPtr widens an 8-bit string
+  // into a buffer it keeps on the JSStringRef, so copying from the same
+  // JSStringRef doesn't widen it a second time.
+  struct measured_string_cache {
+    // Shorter strings are cheaper to widen again than to protect.
+    static constexpr size_t min_length = 256;
+    JSValueRef value{};
+    JSStringRef string{};
+
+    void set(JSContextRef context, JSValueRef measured, JSStringRef chars) {
+      clear(context);
+      // Anything else is converted by calling into JS, which may not give
+      // the same string twice.
+      if (!JSValueIsString(context, measured) || JSStringGetLength(chars) < min_length) {
+        return;
+      }
+      JSValueProtect(context, measured);
+      value = measured;
+      string = JSStringRetain(chars);
+    }
+
+    // Returns the string, which the caller then owns, if measured is the
+    // value it was measured from.
+    JSStringRef take(JSContextRef context, JSValueRef measured) {
+      if (value == nullptr || value != measured) {
+        return nullptr;
+      }
+      JSStringRef result{string};
+      JSValueUnprotect(context, value);
+      value = nullptr;
+      string = nullptr;
+      return result;
+    }
+
+    // Called by the env before it releases its context.
+    void clear(JSContextRef context) {
+      if (value != nullptr) {
+        JSValueUnprotect(context, value);
+        JSStringRelease(string);
+        value = nullptr;
+        string = nullptr;
+      }
+    }
+  };
+  measured_string_cache measured_string;
+
+  // v1 executors are stored with no dispatch_batch or drain_microtasks.
+  const napi_executor_v2 executor;
+  // Tasks held back by dispatch() until the current task_scope ends.
+  std::vector<napi_executor_task> deferred_tasks;
+  // The env whose task is running on this thread, if any.
+  static inline thread_local napi_env__* running_env{};
+  // task_scopes open for this env, which still use it when they end.
+  size_t open_task_scopes{};
+
+  // Set for envs made by napi_env_jsc_create_pooled. The context goes back
+  // to the pool's group when the env is deleted.
+  napi_jsc_context_pool pool{};
+  // How long napi_env_jsc_create* took.
+  uint64_t creation_ns{};
+  // Set by napi_env_jsc_delete. See check_empty.
+  bool delete_requested{};
+
+  napi_env__(JSGlobalContextRef context, napi_executor_v2 executor) : context{context}, executor{executor} {
     JSGlobalContextRetain(context);
+    finalizers->env = this;
+    completions->env = this;
   }
 
-  ~napi_env__() {
-    deinit_refs();
-    JSGlobalContextRelease(context);
-    executor.free(executor.context);
+  ~napi_env__();
+
+  napi_ref alloc_ref();
+  void free_ref(napi_ref ref);
+  void hold_ref(uint32_t index, napi_value value);
+  void drop_ref(uint32_t index);
+
+  JSWeakObjectMapRef weak_refs() {
+    if (weak_map == nullptr) {
+      weak_map = JSWeakObjectMapCreate(context, nullptr, [](JSWeakObjectMapRef, void*) {});
+    }
+    return weak_map;
+  }
+
+  // Growth is reported to JSC so that it counts towards the next collection.
+  // JSC has no way to take a report back, so shrinking only updates the count.
+  int64_t adjust_external_memory(int64_t change_in_bytes) {
+    if (change_in_bytes > 0) {
+      JSReportExtraMemoryCost(context, static_cast<size_t>(change_in_bytes));
+    }
+    return external_memory.fetch_add(change_in_bytes, std::memory_order_relaxed) + change_in_bytes;
   }
 
+  // Safe to call from any thread.
+  void enqueue_completion(void (*run)(void*), void* data) {
+    enqueue(completions, run, data);
+  }
+
+  // Posts a task to the JS thread. Safe to call from any thread. With a v2
+  // executor, tasks posted from within a task_scope are dispatched together
+  // when the outermost scope ends.
+  void dispatch(void (*fn)(void*), void* arg) {
+    if (executor.dispatch_batch != nullptr && running_env == this) {
+      deferred_tasks.push_back({fn, arg});
+      return;
+    }
+    executor.dispatch_async(executor.context, fn, arg);
+  }
+
+  // Marks a task of the shim's own running on the JS thread. When the
+  // outermost one ends, tasks it posted go out as one batch, followed by a
+  // chance for the executor to drain microtasks.
+  class task_scope {
+   public:
+    explicit task_scope(napi_env__* env)
+      : _env{env}
+      , _outer{std::exchange(running_env, env)} {
+      ++_env->open_task_scopes;
+    }
+
+    task_scope(const task_scope&) = delete;
+
+    ~task_scope() {
+      running_env = _outer;
+      --_env->open_task_scopes;
+      if (_outer == _env) {
+        return;
+      }
+      if (!_env->deferred_tasks.empty()) {
+        std::vector<napi_executor_task> tasks;
+        tasks.swap(_env->deferred_tasks);
+        _env->executor.dispatch_batch(_env->executor.context, tasks.data(), tasks.size());
+      }
+      if (_env->executor.drain_microtasks != nullptr) {
+        _env->executor.drain_microtasks(_env->executor.context);
+      }
+    }
+
+   private:
+    napi_env__* _env;
+    napi_env__* _outer;
+  };
+
+  // Once napi_env_jsc_delete has been called, the env is deleted as soon as
+  // nothing keeps it alive. This is usually called from inside a napi call
+  // that still uses the env, so the deletion itself happens on the executor.
   void check_empty() {
-    if (is_deleting || !is_empty()) return;
+    if (!delete_requested || is_deleting || !is_empty()) return;
     is_deleting = true;
-    // TODO: delete
-    // in fact we should strongly retain napi_env__ until check_empty succeeds.
+    dispatch(delete_if_empty, this);
+  }
+
+  bool is_empty() const {
+    return strong_ref_count == 0 && strong_tsfns.empty() && active_async_work == 0;
   }
  private:
   void deinit_refs();
 
-  bool is_empty() const {
-    return strong_refs.empty() && strong_tsfns.empty();
+  static void delete_if_empty(void* data) {
+    napi_env__* env{static_cast<napi_env__*>(data)};
+    env->is_deleting = false;
+    // Something may have revived it in the meantime.
+    if (env->is_empty()) {
+      delete env;
+    }
+  }
+
+  void enqueue(const std::shared_ptr<callback_queue>& queue, void (*run)(void*), void* data) {
+    bool schedule{};
+    {
+      std::lock_guard lock(queue->mutex);
+      queue->entries.push_back({run, data});
+      schedule = !std::exchange(queue->scheduled, true);
+    }
+    if (schedule) {
+      dispatch(drain_callbacks, new std::shared_ptr<callback_queue>{queue});
+    }
+  }
+
+  static void drain_callbacks(void* data) {
+    std::unique_ptr<std::shared_ptr<callback_queue>> queue{static_cast<std::shared_ptr<callback_queue>*>(data)};
+    (*queue)->drain();
   }
+
 };
 
+// Contexts in one group share a VM, so they're much cheaper to create than
+// standalone ones, and share JIT code and structure caches. A used context
+// can't be reset to a pristine global object through the C API, so deleted
+// envs' contexts are released rather than handed to the next tenant, and the
+// pool tops up its spares with fresh contexts in the same group instead.
+// That happens on a thread of the pool's own, so that neither creating nor
+// deleting an env on the JS thread pays for a context.
+struct napi_jsc_context_pool__ {
+  JSContextGroupRef group;
+  size_t target_spares;
+
+  std::mutex mutex;
+  std::vector<JSGlobalContextRef> spares;
+  uint64_t envs_created{};
+  uint64_t envs_deleted{};
+  uint64_t total_creation_ns{};
+  uint64_t max_creation_ns{};
+  uint64_t contexts_replenished{};
+  uint64_t total_replenish_ns{};
+  uint64_t max_replenish_ns{};
+
+  explicit napi_jsc_context_pool__(size_t target_spares)
+    : group{JSContextGroupCreate()}
+    , target_spares{target_spares} {
+  }
+
+  ~napi_jsc_context_pool__() {
+    if (replenisher.joinable()) {
+      {
+        std::lock_guard lock(mutex);
+        stopping = true;
+      }
+      replenish_needed.notify_one();
+      replenisher.join();
+    }
+    for (JSGlobalContextRef context : spares) {
+      JSGlobalContextRelease(context);
+    }
+    JSContextGroupRelease(group);
+  }
+
+  JSGlobalContextRef take() {
+    {
+      std::lock_guard lock(mutex);
+      if (!spares.empty()) {
+        JSGlobalContextRef context{spares.back()};
+        spares.pop_back();
+        return context;
+      }
+    }
+    return JSGlobalContextCreateInGroup(group, nullptr);
+  }
+
+  // Creates spares until there are target_spares of them.
+  void replenish() {
+    while (true) {
+      {
+        std::lock_guard lock(mutex);
+        if (stopping || spares.size() >= target_spares) {
+          return;
+        }
+      }
+      auto start{std::chrono::steady_clock::now()};
+      JSGlobalContextRef context{JSGlobalContextCreateInGroup(group, nullptr)};
+      uint64_t replenish_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      std::lock_guard lock(mutex);
+      spares.push_back(context);
+      ++contexts_replenished;
+      total_replenish_ns += replenish_ns;
+      max_replenish_ns = std::max(max_replenish_ns, replenish_ns);
+    }
+  }
+
+  // Like replenish, but on the pool's thread.
+  void replenish_async() {
+    {
+      std::lock_guard lock(mutex);
+      if (spares.size() >= target_spares) {
+        return;
+      }
+      if (!replenisher.joinable()) {
+        replenisher = std::thread(&napi_jsc_context_pool__::run_replenisher, this);
+      }
+      replenish_requested = true;
+    }
+    replenish_needed.notify_one();
+  }
+
+  void retain() {
+    refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+ private:
+  void run_replenisher() {
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        replenish_needed.wait(lock, [this] { return stopping || replenish_requested; });
+        if (stopping) {
+          return;
+        }
+        replenish_requested = false;
+      }
+      replenish();
+    }
+  }
+
+  // One for the embedder plus one per env.
+  std::atomic<size_t> refs{1};
+  // Started by the first replenish_async. Guarded by mutex.
+  std::thread replenisher;
+  std::condition_variable replenish_needed;
+  bool replenish_requested{};
+  bool stopping{};
+};
+
+static napi_env create_env(JSGlobalContextRef context, napi_executor_v2 executor, napi_jsc_context_pool pool) {
+  auto start{std::chrono::steady_clock::now()};
+  if (pool != nullptr) {
+    pool->retain();
+    context = pool->take();
+  }
+  napi_env env{new napi_env__{context, executor}};
+  if (pool != nullptr) {
+    // The env retains the context itself.
+    JSGlobalContextRelease(context);
+    env->pool = pool;
+  }
+  env->creation_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  if (pool != nullptr) {
+    std::lock_guard lock(pool->mutex);
+    ++pool->envs_created;
+    pool->total_creation_ns += env->creation_ns;
+    pool->max_creation_ns = std::max(pool->max_creation_ns, env->creation_ns);
+  }
+  return env;
+}
+
 napi_env napi_env_jsc_create(JSGlobalContextRef context, napi_executor executor) {
-  return new napi_env__{context, executor};
+  return create_env(context, {
+    .version = executor.version,
+    .context = executor.context,
+    .free = executor.free,
+    .assert_current = executor.assert_current,
+    .dispatch_async = executor.dispatch_async,
+  }, nullptr);
+}
+
+napi_env napi_env_jsc_create_v2(JSGlobalContextRef context, napi_executor_v2 executor) {
+  return create_env(context, executor, nullptr);
+}
+
+napi_jsc_context_pool napi_jsc_context_pool_create(size_t spare_contexts) {
+  napi_jsc_context_pool pool{new napi_jsc_context_pool__{spare_contexts}};
+  pool->replenish();
+  return pool;
+}
+
+void napi_jsc_context_pool_release(napi_jsc_context_pool pool) {
+  pool->release();
 }
 
+JSContextGroupRef napi_jsc_context_pool_get_group(napi_jsc_context_pool pool) {
+  return pool->group;
+}
+
+void napi_jsc_context_pool_get_stats(napi_jsc_context_pool pool, napi_jsc_context_pool_stats* result) {
+  std::lock_guard lock(pool->mutex);
+  result->envs_created = pool->envs_created;
+  result->envs_deleted = pool->envs_deleted;
+  result->spare_contexts = pool->spares.size();
+  result->mean_creation_ns = pool->envs_created == 0 ? 0 : pool->total_creation_ns / pool->envs_created;
+  result->max_creation_ns = pool->max_creation_ns;
+  result->contexts_replenished = pool->contexts_replenished;
+  result->mean_replenish_ns = pool->contexts_replenished == 0 ? 0 : pool->total_replenish_ns / pool->contexts_replenished;
+  result->max_replenish_ns = pool->max_replenish_ns;
+}
+
+napi_env napi_env_jsc_create_pooled(napi_jsc_context_pool pool, napi_executor_v2 executor) {
+  return create_env(nullptr, executor, pool);
+}
+
+void napi_env__::callback_queue::drain() {
+  std::vector<entry> batch;
+  napi_env__* current_env{};
+  {
+    std::lock_guard lock(mutex);
+    batch.swap(entries);
+    scheduled = false;
+    current_env = env;
+  }
+  std::optional<task_scope> scope;
+  if (current_env != nullptr) {
+    scope.emplace(current_env);
+  }
+  for (const entry& e : batch) {
+    e.run(e.data);
+  }
+}
+
+void napi_env__::callback_queue::arm(void* owner, void (*run_now)(void*)) {
+  std::lock_guard lock(mutex);
+  armed[owner] = run_now;
+}
+
+bool napi_env__::callback_queue::post(void* owner, void (*run)(void*)) {
+  napi_env__* current_env{};
+  bool schedule{};
+  {
+    std::lock_guard lock(mutex);
+    if (env == nullptr) {
+      return false;
+    }
+    armed.erase(owner);
+    entries.push_back({run, owner});
+    schedule = !std::exchange(scheduled, true);
+    current_env = env;
+  }
+  // GC callbacks run on the JS thread, which is also where envs are
+  // deleted, so the env is still there.
+  if (schedule) {
+    current_env->dispatch(drain_callbacks, new std::shared_ptr<callback_queue>{current_env->finalizers});
+  }
+  return true;
+}
+
+void napi_env__::callback_queue::finalize_all() {
+  while (true) {
+    std::vector<entry> batch;
+    {
+      std::lock_guard lock(mutex);
+      if (!entries.empty()) {
+        batch.swap(entries);
+      } else if (!armed.empty()) {
+        auto it{armed.begin()};
+        batch.push_back({it->second, it->first});
+        armed.erase(it);
+      } else {
+        env = nullptr;
+        return;
+      }
+    }
+    // Finalizers may arm or post others.
+    for (const entry& e : batch) {
+      e.run(e.data);
+    }
+  }
+}
+
+// The env goes away once it has no strong references, threadsafe functions
+// or async work left, which may be right now. From inside one of the env's
+// own tasks, like a threadsafe function call or a finalizer, the deletion
+// waits for the task to end.
 void napi_env_jsc_delete(napi_env env) {
-  delete env;
+  env->delete_requested = true;
+  if (env->open_task_scopes != 0) {
+    env->check_empty();
+  } else if (env->is_empty()) {
+    delete env;
+  }
 }
 
 struct napi_callback_info__ {
@@ -116,6 +1138,292 @@ struct napi_callback_info__ {
 };
 
 namespace {
+  // Scratch space that lives on the stack unless it's too big to.
+  template <typename T, size_t InlineCount = 256>
+  class ScratchBuffer {
+   public:
+    explicit ScratchBuffer(size_t count)
+      : _heap{count > InlineCount ? new T[count] : nullptr} {
+    }
+
+    T* data() {
+      return _heap ? _heap.get() : _inline;
+    }
+
+    bool OnStack() const {
+      return !_heap;
+    }
+
+   private:
+    T _inline[InlineCount];
+    std::unique_ptr<T[]> _heap;
+  };
+
+  // Returns the length of the all-ASCII prefix of str.
+  size_t ASCIIPrefixLength(const char* str, size_t length) {
+    size_t i{0};
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+      __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i))};
+      int mask{_mm_movemask_epi8(chunk)};
+      if (mask != 0) {
+        return i + __builtin_ctz(mask);
+      }
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= length; i += 16) {
+      if (vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(str + i))) >= 0x80) {
+        break;
+      }
+    }
+#endif
+    while (i < length && static_cast<uint8_t>(str[i]) < 0x80) {
+      ++i;
+    }
+    return i;
+  }
+
+  // Zero-extends each byte of src into dst. This is both the ASCII and the
+  // Latin-1 to UTF-16 conversion.
+  void WidenBytes(const char* src, size_t length, JSChar* dst) {
+    size_t i{0};
+#if defined(__SSE2__)
+    const __m128i zero{_mm_setzero_si128()};
+    for (; i + 16 <= length; i += 16) {
+      __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))};
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= length; i += 16) {
+      uint8x16_t chunk{vld1q_u8(reinterpret_cast<const uint8_t*>(src + i))};
+      vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(chunk)));
+      vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_high_u8(chunk));
+    }
+#endif
+    for (; i < length; ++i) {
+      dst[i] = static_cast<uint8_t>(src[i]);
+    }
+  }
+
+  // Transcodes UTF-8 to UTF-16, which never needs more code units than the
+  // input has bytes. Ill-formed sequences become U+FFFD, one per maximal
+  // subpart as the Unicode standard recommends. Returns the number of code
+  // units written.
+  size_t UTF8ToUTF16(const char* src, size_t length, JSChar* dst) {
+    size_t i{0};
+    size_t out{0};
+    while (i < length) {
+      size_t ascii{ASCIIPrefixLength(src + i, length - i)};
+      WidenBytes(src + i, ascii, dst + out);
+      i += ascii;
+      out += ascii;
+      if (i == length) {
+        break;
+      }
+
+      uint8_t lead{static_cast<uint8_t>(src[i])};
+      size_t needed{};
+      uint32_t code_point{};
+      // Bounds for the first continuation byte, which exclude overlong
+      // encodings, surrogates and code points past U+10FFFF.
+      uint8_t lower{0x80};
+      uint8_t upper{0xBF};
+      if (lead >= 0xC2 && lead <= 0xDF) {
+        needed = 1;
+        code_point = lead & 0x1F;
+      } else if (lead >= 0xE0 && lead <= 0xEF) {
+        needed = 2;
+        code_point = lead & 0x0F;
+        if (lead == 0xE0) lower = 0xA0;
+        if (lead == 0xED) upper = 0x9F;
+      } else if (lead >= 0xF0 && lead <= 0xF4) {
+        needed = 3;
+        code_point = lead & 0x07;
+        if (lead == 0xF0) lower = 0x90;
+        if (lead == 0xF4) upper = 0x8F;
+      } else {
+        dst[out++] = 0xFFFD;
+        ++i;
+        continue;
+      }
+
+      size_t consumed{1};
+      for (; consumed <= needed && i + consumed < length; ++consumed) {
+        uint8_t byte{static_cast<uint8_t>(src[i + consumed])};
+        if (byte < lower || byte > upper) {
+          break;
+        }
+        lower = 0x80;
+        upper = 0xBF;
+        code_point = (code_point << 6) | (byte & 0x3F);
+      }
+      i += consumed;
+      if (consumed <= needed) {
+        dst[out++] = 0xFFFD;
+      } else if (code_point >= 0x10000) {
+        code_point -= 0x10000;
+        dst[out++] = static_cast<JSChar>(0xD800 + (code_point >> 10));
+        dst[out++] = static_cast<JSChar>(0xDC00 + (code_point & 0x3FF));
+      } else {
+        dst[out++] = static_cast<JSChar>(code_point);
+      }
+    }
+    return out;
+  }
+
+  // Reads the code point at chars[i] and returns the number of code units it
+  // spans. Unpaired surrogates read as U+FFFD, as JSC encodes them in UTF-8.
+  size_t DecodeUTF16(const JSChar* chars, size_t length, size_t i, uint32_t* code_point) {
+    JSChar unit{chars[i]};
+    if (unit < 0xD800 || unit > 0xDFFF) {
+      *code_point = unit;
+      return 1;
+    }
+    if (unit <= 0xDBFF && i + 1 < length && chars[i + 1] >= 0xDC00 && chars[i + 1] <= 0xDFFF) {
+      *code_point = 0x10000 + ((unit - 0xD800) << 10) + (chars[i + 1] - 0xDC00);
+      return 2;
+    }
+    *code_point = 0xFFFD;
+    return 1;
+  }
+
+  size_t UTF8Length(uint32_t code_point) {
+    return code_point < 0x80 ? 1 : code_point < 0x800 ? 2 : code_point < 0x10000 ? 3 : 4;
+  }
+
+  // The number of bytes chars takes up in UTF-8, without transcoding it.
+  // Chunks of 8 code units without surrogates are counted in one go.
+  size_t UTF16LengthAsUTF8(const JSChar* chars, size_t length) {
+    size_t bytes{0};
+    size_t i{0};
+    while (i < length) {
+      size_t end{length};
+#if defined(__SSE2__)
+      if (i + 8 <= length) {
+        const __m128i zero{_mm_setzero_si128()};
+        __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(chars + i))};
+        __m128i surrogates{_mm_cmpeq_epi16(_mm_and_si128(chunk, _mm_set1_epi16(static_cast<short>(0xF800))),
+                                           _mm_set1_epi16(static_cast<short>(0xD800)))};
+        if (_mm_movemask_epi8(surrogates) == 0) {
+          // Two mask bits per code unit.
+          int one_byte{_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(chunk, _mm_set1_epi16(0x7F)), zero))};
+          int two_bytes{_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(chunk, _mm_set1_epi16(0x7FF)), zero))};
+          bytes += 24 - (__builtin_popcount(one_byte) + __builtin_popcount(two_bytes)) / 2;
+          i += 8;
+          continue;
+        }
+        end = i + 8;
+      }
+#elif defined(__aarch64__)
+      if (i + 8 <= length) {
+        uint16x8_t chunk{vld1q_u16(reinterpret_cast<const uint16_t*>(chars + i))};
+        uint16x8_t surrogates{vceqq_u16(vandq_u16(chunk, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800))};
+        if (vmaxvq_u16(surrogates) == 0) {
+          uint16_t one_byte{vaddvq_u16(vshrq_n_u16(vcltq_u16(chunk, vdupq_n_u16(0x80)), 15))};
+          uint16_t two_bytes{vaddvq_u16(vshrq_n_u16(vcltq_u16(chunk, vdupq_n_u16(0x800)), 15))};
+          bytes += 24 - one_byte - two_bytes;
+          i += 8;
+          continue;
+        }
+        end = i + 8;
+      }
+#endif
+      while (i < end) {
+        uint32_t code_point{};
+        i += DecodeUTF16(chars, length, i, &code_point);
+        bytes += UTF8Length(code_point);
+      }
+    }
+    return bytes;
+  }
+
+  // Transcodes as many whole code points as fit in capacity bytes and returns
+  // the number of bytes written. Runs of ASCII are narrowed 8 at a time.
+  size_t UTF16ToUTF8(const JSChar* chars, size_t length, char* buf, size_t capacity) {
+    size_t i{0};
+    size_t out{0};
+    while (i < length) {
+#if defined(__SSE2__)
+      if (i + 8 <= length && out + 8 <= capacity) {
+        __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(chars + i))};
+        __m128i ascii{_mm_cmpeq_epi16(_mm_subs_epu16(chunk, _mm_set1_epi16(0x7F)), _mm_setzero_si128())};
+        if (_mm_movemask_epi8(ascii) == 0xFFFF) {
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(buf + out), _mm_packus_epi16(chunk, chunk));
+          i += 8;
+          out += 8;
+          continue;
+        }
+      }
+#elif defined(__aarch64__)
+      if (i + 8 <= length && out + 8 <= capacity) {
+        uint16x8_t chunk{vld1q_u16(reinterpret_cast<const uint16_t*>(chars + i))};
+        if (vmaxvq_u16(chunk) < 0x80) {
+          vst1_u8(reinterpret_cast<uint8_t*>(buf + out), vmovn_u16(chunk));
+          i += 8;
+          out += 8;
+          continue;
+        }
+      }
+#endif
+      uint32_t code_point{};
+      size_t units{DecodeUTF16(chars, length, i, &code_point)};
+      size_t size{UTF8Length(code_point)};
+      if (out + size > capacity) {
+        break;
+      }
+      switch (size) {
+        case 1:
+          buf[out] = static_cast<char>(code_point);
+          break;
+        case 2:
+          buf[out] = static_cast<char>(0xC0 | (code_point >> 6));
+          buf[out + 1] = static_cast<char>(0x80 | (code_point & 0x3F));
+          break;
+        case 3:
+          buf[out] = static_cast<char>(0xE0 | (code_point >> 12));
+          buf[out + 1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+          buf[out + 2] = static_cast<char>(0x80 | (code_point & 0x3F));
+          break;
+        default:
+          buf[out] = static_cast<char>(0xF0 | (code_point >> 18));
+          buf[out + 1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+          buf[out + 2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+          buf[out + 3] = static_cast<char>(0x80 | (code_point & 0x3F));
+          break;
+      }
+      i += units;
+      out += size;
+    }
+    return out;
+  }
+
+  // Narrows each code unit to a byte, replacing anything outside Latin-1
+  // with '?'.
+  void NarrowToLatin1(const JSChar* chars, size_t length, char* buf) {
+    size_t i{0};
+#if defined(__SSE2__)
+    const __m128i replacement{_mm_set1_epi16('?')};
+    for (; i + 8 <= length; i += 8) {
+      __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(chars + i))};
+      __m128i latin1{_mm_cmpeq_epi16(_mm_subs_epu16(chunk, _mm_set1_epi16(0xFF)), _mm_setzero_si128())};
+      chunk = _mm_or_si128(_mm_and_si128(latin1, chunk), _mm_andnot_si128(latin1, replacement));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(buf + i), _mm_packus_epi16(chunk, chunk));
+    }
+#elif defined(__aarch64__)
+    const uint16x8_t replacement{vdupq_n_u16('?')};
+    for (; i + 8 <= length; i += 8) {
+      uint16x8_t chunk{vld1q_u16(reinterpret_cast<const uint16_t*>(chars + i))};
+      chunk = vbslq_u16(vcleq_u16(chunk, vdupq_n_u16(0xFF)), chunk, replacement);
+      vst1_u8(reinterpret_cast<uint8_t*>(buf + i), vmovn_u16(chunk));
+    }
+#endif
+    for (; i < length; ++i) {
+      const JSChar ch{chars[i]};
+      buf[i] = (ch < 256) ? ch : '?';
+    }
+  }
+
   class JSString {
    public:
     JSString(const JSString&) = delete;
@@ -143,6 +1451,20 @@ namespace {
       return {string};
     }
 
+    static JSString Latin1(const char* string, size_t length = NAPI_AUTO_LENGTH) {
+      if (length == NAPI_AUTO_LENGTH) {
+        length = std::strlen(string);
+      }
+      // ASCII is the same in both encodings, and CreateUTF8 keeps it in 8-bit
+      // storage rather than widening it.
+      if (ASCIIPrefixLength(string, length) == length) {
+        return {CreateUTF8(string, length)};
+      }
+      ScratchBuffer<JSChar> chars{length};
+      WidenBytes(string, length, chars.data());
+      return {JSStringCreateWithCharacters(chars.data(), length)};
+    }
+
     operator JSStringRef() const {
       return _string;
     }
@@ -152,8 +1474,7 @@ namespace {
     }
 
     size_t LengthUTF8() const {
-      std::vector<char> buffer(JSStringGetMaximumUTF8CStringSize(_string));
-      return JSStringGetUTF8CString(_string, buffer.data(), buffer.size()) - 1;
+      return UTF16LengthAsUTF8(JSStringGetCharactersPtr(_string), JSStringGetLength(_string));
     }
 
     size_t LengthLatin1() const {
@@ -161,32 +1482,37 @@ namespace {
       return JSStringGetLength(_string);
     }
 
+    // The copies below truncate to bufsize - 1 code units or bytes and null
+    // terminate, like Node. A bufsize of 0 copies nothing.
     void CopyTo(JSChar* buf, size_t bufsize, size_t* result) const {
-      size_t length{JSStringGetLength(_string)};
-      const JSChar* chars{JSStringGetCharactersPtr(_string)};
-      size_t size{std::min(length, bufsize - 1)};
-      std::memcpy(buf, chars, size);
-      buf[size] = 0;
+      size_t size{0};
+      if (bufsize != 0) {
+        size = std::min(static_cast<size_t>(JSStringGetLength(_string)), bufsize - 1);
+        std::memcpy(buf, JSStringGetCharactersPtr(_string), size * sizeof(JSChar));
+        buf[size] = 0;
+      }
       if (result != nullptr) {
         *result = size;
       }
     }
 
     void CopyToUTF8(char* buf, size_t bufsize, size_t* result) const {
-      size_t size{JSStringGetUTF8CString(_string, buf, bufsize)};
+      size_t size{0};
+      if (bufsize != 0) {
+        size = UTF16ToUTF8(JSStringGetCharactersPtr(_string), JSStringGetLength(_string), buf, bufsize - 1);
+        buf[size] = 0;
+      }
       if (result != nullptr) {
-        // JSStringGetUTF8CString returns size with null terminator.
-        *result = size - 1;
+        *result = size;
       }
     }
 
     void CopyToLatin1(char* buf, size_t bufsize, size_t* result) const {
-      size_t length{JSStringGetLength(_string)};
-      const JSChar* chars{JSStringGetCharactersPtr(_string)};
-      size_t size{std::min(length, bufsize - 1)};
-      for (int i = 0; i < size; ++i) {
-        const JSChar ch{chars[i]};
-        buf[i] = (ch < 256) ? ch : '?';
+      size_t size{0};
+      if (bufsize != 0) {
+        size = std::min(static_cast<size_t>(JSStringGetLength(_string)), bufsize - 1);
+        NarrowToLatin1(JSStringGetCharactersPtr(_string), size, buf);
+        buf[size] = 0;
       }
       if (result != nullptr) {
         *result = size;
@@ -195,14 +1521,32 @@ namespace {
 
    private:
     static JSStringRef CreateUTF8(const char* string, size_t length) {
-      if (length == NAPI_AUTO_LENGTH) {
+      // Null-terminated strings are measured and take the same paths as
+      // sized ones, so invalid UTF-8 becomes U+FFFD either way rather than
+      // JSStringCreateWithUTF8CString's empty string.
+      bool terminated{length == NAPI_AUTO_LENGTH};
+      if (terminated) {
+        length = std::strlen(string);
+      }
+
+      // JSStringCreateWithUTF8CString stores all-ASCII strings with one byte
+      // per character, which is worth a copy to get a null terminator. It
+      // would stop at an embedded null though.
+      size_t ascii{ASCIIPrefixLength(string, length)};
+      if (ascii == length && terminated) {
         return JSStringCreateWithUTF8CString(string);
       }
+      if (ascii == length && std::memchr(string, 0, length) == nullptr) {
+        ScratchBuffer<char> copy{length + 1};
+        std::memcpy(copy.data(), string, length);
+        copy.data()[length] = 0;
+        return JSStringCreateWithUTF8CString(copy.data());
+      }
 
-      auto cfstr = CFStringCreateWithBytesNoCopy(nullptr, reinterpret_cast<const UInt8 *>(string), length, kCFStringEncodingUTF8, false, kCFAllocatorNull);
-      auto jsstr = JSStringCreateWithCFString(cfstr);
-      CFRelease(cfstr);
-      return jsstr;
+      ScratchBuffer<JSChar> chars{length};
+      WidenBytes(string, ascii, chars.data());
+      size_t count{ascii + UTF8ToUTF16(string + ascii, length - ascii, chars.data() + ascii)};
+      return JSStringCreateWithCharacters(chars.data(), count);
     }
 
     JSString(JSStringRef string)
@@ -271,6 +1615,178 @@ namespace {
     return napi_ok;
   }
 
+  struct IntrinsicInfo {
+    Intrinsic parent;
+    const char* name;
+  };
+
+  // Indexed by Intrinsic. Each entry is looked up as parent[name].
+  const IntrinsicInfo intrinsic_infos[] = {
+    { Intrinsic::Global, nullptr },
+    { Intrinsic::Global, "Object" },
+    { Intrinsic::Object, "freeze" },
+    { Intrinsic::Object, "seal" },
+    { Intrinsic::Object, "prototype" },
+    { Intrinsic::ObjectPrototype, "hasOwnProperty" },
+    { Intrinsic::Global, "Function" },
+    { Intrinsic::Function, "prototype" },
+    { Intrinsic::Global, "Symbol" },
+    { Intrinsic::Global, "Error" },
+    { Intrinsic::Global, "TypeError" },
+    { Intrinsic::Global, "RangeError" },
+    { Intrinsic::Global, "Promise" },
+    { Intrinsic::Global, "DataView" },
+    { Intrinsic::Global, "WeakMap" },
+    { Intrinsic::WeakMap, "prototype" },
+    { Intrinsic::WeakMapPrototype, "get" },
+    { Intrinsic::WeakMapPrototype, "set" },
+    { Intrinsic::WeakMapPrototype, "has" },
+  };
+  static_assert(std::size(intrinsic_infos) == static_cast<size_t>(Intrinsic::Count),
+    "Count of intrinsic infos must match count of intrinsics");
+
+  napi_status GetIntrinsic(napi_env env, Intrinsic intrinsic, JSObjectRef* result) {
+    if (intrinsic == Intrinsic::Global) {
+      *result = JSContextGetGlobalObject(env->context);
+      return napi_ok;
+    }
+
+    JSValueRef& cached{env->intrinsics[static_cast<size_t>(intrinsic)]};
+    if (cached == nullptr) {
+      const IntrinsicInfo& info{intrinsic_infos[static_cast<size_t>(intrinsic)]};
+      JSObjectRef parent{};
+      CHECK_NAPI(GetIntrinsic(env, info.parent, &parent));
+
+      JSValueRef exception{};
+      JSValueRef value{JSObjectGetProperty(env->context, parent, JSString(info.name), &exception)};
+      CHECK_JSC(env, exception);
+      RETURN_STATUS_IF_FALSE(env, JSValueIsObject(env->context, value), napi_generic_failure);
+
+      JSValueProtect(env->context, value);
+      cached = value;
+    }
+
+    *result = ToJSObject(env, ToNapi(cached));
+    return napi_ok;
+  }
+
+  napi_status GetIntrinsic(napi_env env, Intrinsic intrinsic, napi_value* result) {
+    JSObjectRef object{};
+    CHECK_NAPI(GetIntrinsic(env, intrinsic, &object));
+    *result = ToNapi(object);
+    return napi_ok;
+  }
+
+  // Indexed by Helper. Each entry is evaluated as a script and must produce
+  // an object.
+  const char* const helper_sources[] = {
+    // Single-element arrays for moving 64-bit integers in and out of BigInts
+    // without going through strings.
+    "new BigInt64Array(1)",
+    "new BigUint64Array(1)",
+    "(function (words, negative) {\n"
+    "  let value = 0n;\n"
+    "  for (let i = words.length; i-- > 0;) value = (value << 64n) | words[i];\n"
+    "  return negative ? -value : value;\n"
+    "})",
+    // Fills as many words as fit and returns the number of words needed,
+    // bitwise negated if the value is negative.
+    "(function (value, words) {\n"
+    "  const negative = value < 0n;\n"
+    "  if (negative) value = -value;\n"
+    "  let count = 0;\n"
+    "  for (; value !== 0n; value >>= 64n, ++count) {\n"
+    "    if (count < words.length) words[count] = value;\n"
+    "  }\n"
+    "  return negative ? ~count : count;\n"
+    "})",
+    // napi_define_properties for the cases JSObjectSetPropertyForKey doesn't
+    // cover. `attributes` is a napi_property_attributes; the property is an
+    // accessor if either get or set is given. Returns false if the property
+    // can't be defined.
+    "(() => {\n"
+    "  const defineProperty = Reflect.defineProperty;\n"
+    "  return (target, key, attributes, value, get, set) => {\n"
+    "    const descriptor = { configurable: (attributes & 4) !== 0, enumerable: (attributes & 2) !== 0 };\n"
+    "    if (get === undefined && set === undefined) {\n"
+    "      descriptor.writable = (attributes & 1) !== 0;\n"
+    "      descriptor.value = value;\n"
+    "    } else {\n"
+    "      if (get !== undefined) descriptor.get = get;\n"
+    "      if (set !== undefined) descriptor.set = set;\n"
+    "    }\n"
+    "    return defineProperty(target, key, descriptor);\n"
+    "  };\n"
+    "})()",
+    // napi_get_all_property_names for the cases JSObjectCopyPropertyNames
+    // doesn't cover. `filter` is a napi_key_filter. Keys seen lower in the
+    // prototype chain shadow keys further up, whether or not they're filtered.
+    "(function (object, ownOnly, filter, keepNumbers) {\n"
+    "  const keys = [];\n"
+    "  const seen = ownOnly ? null : new Set();\n"
+    "  for (let o = object; o !== null; o = Object.getPrototypeOf(o)) {\n"
+    "    for (const key of Reflect.ownKeys(o)) {\n"
+    "      if (filter & (typeof key === 'symbol' ? 16 : 8)) continue;\n"
+    "      if (seen) {\n"
+    "        if (seen.has(key)) continue;\n"
+    "        seen.add(key);\n"
+    "      }\n"
+    "      if (filter & 7) {\n"
+    "        const d = Object.getOwnPropertyDescriptor(o, key);\n"
+    "        if ((filter & 1) && d.writable === false) continue;\n"
+    "        if ((filter & 2) && !d.enumerable) continue;\n"
+    "        if ((filter & 4) && !d.configurable) continue;\n"
+    "      }\n"
+    "      const index = keepNumbers && typeof key === 'string' ? key >>> 0 : -1;\n"
+    "      keys.push(index !== 4294967295 && String(index) === key ? index : key);\n"
+    "    }\n"
+    "    if (ownOnly) break;\n"
+    "  }\n"
+    "  return keys;\n"
+    "})",
+    // ArrayBuffer.prototype.transfer is the only way to detach a buffer from
+    // the public API. Transferring to a length of 0 releases the old contents
+    // right away instead of handing them to a new buffer. Buffers whose bytes
+    // were pinned through the C API may be copied instead, so this returns
+    // whether the buffer actually ended up detached, which is also false if
+    // the engine is too old to support it.
+    "(() => {\n"
+    "  const transfer = ArrayBuffer.prototype.transfer;\n"
+    "  const detached = Object.getOwnPropertyDescriptor(ArrayBuffer.prototype, 'detached')?.get;\n"
+    "  return (buffer) => {\n"
+    "    if (!transfer || !detached) return false;\n"
+    "    try {\n"
+    "      transfer.call(buffer, 0);\n"
+    "    } catch {\n"
+    "      return false;\n"
+    "    }\n"
+    "    return detached.call(buffer);\n"
+    "  };\n"
+    "})()",
+    "(() => {\n"
+    "  const get = Object.getOwnPropertyDescriptor(ArrayBuffer.prototype, 'detached')?.get;\n"
+    "  return get ? (buffer) => get.call(buffer) : () => false;\n"
+    "})()",
+  };
+  static_assert(std::size(helper_sources) == static_cast<size_t>(Helper::Count),
+    "Count of helper sources must match count of helpers");
+
+  napi_status GetHelper(napi_env env, Helper helper, JSObjectRef* result) {
+    JSValueRef& cached{env->helpers[static_cast<size_t>(helper)]};
+    if (cached == nullptr) {
+      JSValueRef exception{};
+      JSValueRef value{JSEvaluateScript(env->context, JSString(helper_sources[static_cast<size_t>(helper)]), nullptr, nullptr, 1, &exception)};
+      CHECK_JSC(env, exception);
+      RETURN_STATUS_IF_FALSE(env, JSValueIsObject(env->context, value), napi_generic_failure);
+
+      JSValueProtect(env->context, value);
+      cached = value;
+    }
+
+    *result = ToJSObject(env, ToNapi(cached));
+    return napi_ok;
+  }
+
   enum class NativeType {
     Constructor,
     External,
@@ -289,22 +1805,15 @@ namespace {
       return reinterpret_cast<T*>(JSObjectGetPrivate(obj));
     }
 
+    // Returns the info attached to obj if it is of type T. Native objects
+    // carry their info as private data, so this is a constant-time lookup.
     template<typename T>
-    static T* FindInPrototypeChain(JSContextRef ctx, JSObjectRef obj) {
-      while (true) {
-        JSValueRef exception{};
-        JSObjectRef prototype = JSValueToObject(ctx, JSObjectGetPrototype(ctx, obj), &exception);
-        if (exception != nullptr) {
-          return nullptr;
-        }
-
-        NativeInfo* info = Get<NativeInfo>(prototype);
-        if (info != nullptr && info->Type() == T::StaticType) {
-          return reinterpret_cast<T*>(info);
-        }
-
-        obj = prototype;
+    static T* GetOfType(JSObjectRef obj) {
+      NativeInfo* info = Get<NativeInfo>(obj);
+      if (info != nullptr && info->Type() == T::StaticType) {
+        return reinterpret_cast<T*>(info);
       }
+      return nullptr;
     }
 
    protected:
@@ -312,6 +1821,40 @@ namespace {
       : _type{type} {
     }
 
+    // Types can override this to add callbacks to their shared class.
+    static void Define(JSClassDefinition& definition) {
+    }
+
+    // Returns the env's shared class for T, creating it on first use.
+    template<typename T>
+    static JSClassRef Class(napi_env env) {
+      JSClassRef& native_class{env->native_classes[static_cast<size_t>(T::StaticType)]};
+      if (native_class == nullptr) {
+        JSClassDefinition definition{kJSClassDefinitionEmpty};
+        definition.className = T::ClassName;
+        definition.finalize = T::Finalize;
+        T::Define(definition);
+        native_class = JSClassCreate(&definition);
+      }
+      return native_class;
+    }
+
+    // Gives a callable native object the name and prototype of a function.
+    static napi_status MakeFunctionLike(napi_env env, JSObjectRef object, const char* name, size_t length) {
+      JSObjectRef function_prototype{};
+      CHECK_NAPI(GetIntrinsic(env, Intrinsic::FunctionPrototype, &function_prototype));
+      JSObjectSetPrototype(env->context, object, function_prototype);
+
+      if (name != nullptr) {
+        JSValueRef exception{};
+        JSObjectSetProperty(env->context, object, JSString("name"),
+          JSValueMakeString(env->context, JSString(name, length)),
+          kJSPropertyAttributeReadOnly | kJSPropertyAttributeDontEnum, &exception);
+        CHECK_JSC(env, exception);
+      }
+      return napi_ok;
+    }
+
    private:
     NativeType _type;
   };
@@ -331,14 +1874,20 @@ namespace {
         return napi_set_last_error(env, napi_generic_failure);
       }
 
-      JSObjectRef constructor{JSObjectMakeConstructor(env->context, nullptr, CallAsConstructor)};
-      JSObjectRef prototype{JSObjectMake(env->context, info->_class, info)};
-      JSObjectSetPrototype(env->context, prototype, JSObjectGetPrototype(env->context, constructor));
-      JSObjectSetPrototype(env->context, constructor, prototype);
+      // The constructor is itself the native object, so calls can find
+      // their info without walking the prototype chain.
+      JSObjectRef constructor{JSObjectMake(env->context, Class<ConstructorInfo>(env), info)};
+      CHECK_NAPI(MakeFunctionLike(env, constructor, utf8name, length));
+
+      JSObjectRef prototype{JSObjectMake(env->context, nullptr, nullptr)};
 
       JSValueRef exception{};
       JSObjectSetProperty(env->context, prototype, JSString("constructor"), constructor,
-        kJSPropertyAttributeReadOnly | kJSPropertyAttributeDontDelete, &exception);
+        kJSPropertyAttributeDontEnum, &exception);
+      CHECK_JSC(env, exception);
+
+      JSObjectSetProperty(env->context, constructor, JSString("prototype"), prototype,
+        kJSPropertyAttributeDontEnum | kJSPropertyAttributeDontDelete, &exception);
       CHECK_JSC(env, exception);
 
       *result = ToNapi(constructor);
@@ -346,20 +1895,21 @@ namespace {
     }
 
    private:
+    friend class NativeInfo;
+    static constexpr const char* ClassName = "Native (Constructor)";
+
+    static void Define(JSClassDefinition& definition) {
+      definition.callAsConstructor = CallAsConstructor;
+      definition.callAsFunction = CallAsFunction;
+      definition.hasInstance = HasInstance;
+    }
+
     ConstructorInfo(napi_env env, const char* name, size_t length, napi_callback cb, void* data)
       : NativeInfo{NativeType::Constructor}
       , _env{env}
       , _name{name, (length == NAPI_AUTO_LENGTH ? std::strlen(name) : length)}
       , _cb{cb}
       , _data{data} {
-      JSClassDefinition classDefinition{kJSClassDefinitionEmpty};
-      classDefinition.className = _name.data();
-      classDefinition.finalize = Finalize;
-      _class = JSClassCreate(&classDefinition);
-    }
-
-    ~ConstructorInfo() {
-      JSClassRelease(_class);
     }
 
     // JSObjectCallAsConstructorCallback
@@ -368,13 +1918,19 @@ namespace {
                                          size_t argumentCount,
                                          const JSValueRef arguments[],
                                          JSValueRef* exception) {
-      ConstructorInfo* info = NativeInfo::FindInPrototypeChain<ConstructorInfo>(ctx, constructor);
+      ConstructorInfo* info = NativeInfo::Get<ConstructorInfo>(constructor);
 
       // Make sure any errors encountered last time we were in N-API are gone.
       napi_clear_last_error(info->_env);
 
       JSObjectRef instance{JSObjectMake(ctx, nullptr, nullptr)};
-      JSObjectSetPrototype(ctx, instance, JSObjectGetPrototype(ctx, constructor));
+      JSValueRef prototype{GetPrototypeProperty(info->_env, constructor, exception)};
+      if (*exception != nullptr) {
+        return nullptr;
+      }
+      if (JSValueIsObject(ctx, prototype)) {
+        JSObjectSetPrototype(ctx, instance, prototype);
+      }
 
       napi_callback_info__ cbinfo{};
       cbinfo.thisArg = ToNapi(instance);
@@ -393,6 +1949,60 @@ namespace {
       return ToJSObject(info->_env, result);
     }
 
+    // JSObjectCallAsFunctionCallback
+    static JSValueRef CallAsFunction(JSContextRef ctx,
+                                     JSObjectRef constructor,
+                                     JSObjectRef thisObject,
+                                     size_t argumentCount,
+                                     const JSValueRef arguments[],
+                                     JSValueRef* exception) {
+      ConstructorInfo* info = NativeInfo::Get<ConstructorInfo>(constructor);
+
+      // Make sure any errors encountered last time we were in N-API are gone.
+      napi_clear_last_error(info->_env);
+
+      napi_callback_info__ cbinfo{};
+      cbinfo.thisArg = ToNapi(thisObject);
+      cbinfo.newTarget = nullptr;
+      cbinfo.argc = argumentCount;
+      cbinfo.argv = ToNapi(arguments);
+      cbinfo.data = info->_data;
+
+      napi_value result = info->_cb(info->_env, &cbinfo);
+
+      if (info->_env->last_exception != nullptr) {
+        *exception = info->_env->last_exception;
+        info->_env->last_exception = nullptr;
+      }
+
+      return ToJSValue(result);
+    }
+
+    // JSObjectHasInstanceCallback
+    static bool HasInstance(JSContextRef ctx,
+                            JSObjectRef constructor,
+                            JSValueRef possibleInstance,
+                            JSValueRef* exception) {
+      ConstructorInfo* info = NativeInfo::Get<ConstructorInfo>(constructor);
+      JSValueRef prototype{GetPrototypeProperty(info->_env, constructor, exception)};
+      if (*exception != nullptr || !JSValueIsObject(ctx, prototype) || !JSValueIsObject(ctx, possibleInstance)) {
+        return false;
+      }
+
+      JSValueRef current{JSObjectGetPrototype(ctx, const_cast<JSObjectRef>(possibleInstance))};
+      while (JSValueIsObject(ctx, current)) {
+        if (current == prototype) {
+          return true;
+        }
+        current = JSObjectGetPrototype(ctx, const_cast<JSObjectRef>(current));
+      }
+      return false;
+    }
+
+    static JSValueRef GetPrototypeProperty(napi_env env, JSObjectRef constructor, JSValueRef* exception) {
+      return JSObjectGetProperty(env->context, constructor, env->property_keys.get("prototype"), exception);
+    }
+
     // JSObjectFinalizeCallback
     static void Finalize(JSObjectRef object) {
       ConstructorInfo* info = NativeInfo::Get<ConstructorInfo>(object);
@@ -405,7 +2015,6 @@ namespace {
     std::string _name;
     napi_callback _cb;
     void* _data;
-    JSClassRef _class;
   };
 
   class FunctionInfo : public NativeInfo {
@@ -423,29 +2032,28 @@ namespace {
         return napi_set_last_error(env, napi_generic_failure);
       }
 
-      JSObjectRef function{JSObjectMakeFunctionWithCallback(env->context, JSString(utf8name), CallAsFunction)};
-      JSObjectRef prototype{JSObjectMake(env->context, info->_class, info)};
-      JSObjectSetPrototype(env->context, prototype, JSObjectGetPrototype(env->context, function));
-      JSObjectSetPrototype(env->context, function, prototype);
+      // The function is itself the native object, so calls can find their
+      // info without walking the prototype chain.
+      JSObjectRef function{JSObjectMake(env->context, Class<FunctionInfo>(env), info)};
+      CHECK_NAPI(MakeFunctionLike(env, function, utf8name, length));
 
       *result = ToNapi(function);
       return napi_ok;
     }
 
    private:
+    friend class NativeInfo;
+    static constexpr const char* ClassName = "Native";
+
+    static void Define(JSClassDefinition& definition) {
+      definition.callAsFunction = CallAsFunction;
+    }
+
     FunctionInfo(napi_env env, napi_callback cb, void* data)
       : NativeInfo{NativeType::Function}
       , _env{env}
       , _cb{cb}
       , _data{data} {
-      JSClassDefinition definition{kJSClassDefinitionEmpty};
-      definition.className = "Native";
-      definition.finalize = Finalize;
-      _class = JSClassCreate(&definition);
-    }
-
-    ~FunctionInfo() {
-      JSClassRelease(_class);
     }
 
     // JSObjectCallAsFunctionCallback
@@ -455,7 +2063,7 @@ namespace {
                                      size_t argumentCount,
                                      const JSValueRef arguments[],
                                      JSValueRef* exception) {
-      FunctionInfo* info = NativeInfo::FindInPrototypeChain<FunctionInfo>(ctx, function);
+      FunctionInfo* info = NativeInfo::Get<FunctionInfo>(function);
 
       // Make sure any errors encountered last time we were in N-API are gone.
       napi_clear_last_error(info->_env);
@@ -487,7 +2095,6 @@ namespace {
     napi_env _env;
     napi_callback _cb;
     void* _data;
-    JSClassRef _class;
   };
 
   template<typename T, NativeType TType>
@@ -495,10 +2102,6 @@ namespace {
    public:
     static const NativeType StaticType = TType;
 
-    ~BaseInfoT() {
-      JSClassRelease(_class);
-    }
-
     napi_env Env() const {
       return _env;
     }
@@ -511,35 +2114,68 @@ namespace {
       return _data;
     }
 
-    using FinalizerT = std::function<void(T*)>;
-    void AddFinalizer(FinalizerT finalizer) {
-      _finalizers.push_back(finalizer);
+    void AddFinalizer(napi_finalize cb, void* data, void* hint) {
+      _finalizers.push_back({cb, data, hint});
+      Arm();
     }
 
    protected:
-    BaseInfoT(napi_env env, const char* className)
+    friend class NativeInfo;
+
+    struct Finalizer {
+      napi_finalize cb;
+      void* data;
+      void* hint;
+    };
+
+    BaseInfoT(napi_env env)
       : NativeInfo{TType}
       , _env{env} {
-      JSClassDefinition definition{kJSClassDefinitionEmpty};
-      definition.className = className;
-      definition.finalize = Finalize;
-      _class = JSClassCreate(&definition);
+    }
+
+    // Lets the env run the finalizers if it's deleted before the object is
+    // collected. From then on the info only holds the finalizer queue, not
+    // the env.
+    void Arm() {
+      if (_queue == nullptr) {
+        _queue = _env->finalizers;
+        _queue->arm(static_cast<T*>(this), RunArmedFinalizers);
+      }
+    }
+
+    // Types with finalizers of their own add them to _finalizers here.
+    void TakeFinalizers() {
     }
 
     // JSObjectFinalizeCallback
     static void Finalize(JSObjectRef object) {
       T* info = Get<T>(object);
       assert(info->Type() == TType);
-      for (const FinalizerT& finalizer : info->_finalizers) {
-        finalizer(info);
+      if (info->_queue == nullptr || !info->_queue->post(info, RunFinalizers)) {
+        delete info;
       }
+    }
+
+    static void RunFinalizers(void* data) {
+      T* info{static_cast<T*>(data)};
+      RunArmedFinalizers(info);
       delete info;
     }
 
+    // Runs the finalizers but leaves the info to the object.
+    static void RunArmedFinalizers(void* data) {
+      T* info{static_cast<T*>(data)};
+      info->TakeFinalizers();
+      for (const Finalizer& finalizer : info->_finalizers) {
+        finalizer.cb(info->_env, finalizer.data, finalizer.hint);
+      }
+      info->_finalizers.clear();
+    }
+
     napi_env _env;
     void* _data{};
-    std::vector<FinalizerT> _finalizers{};
-    JSClassRef _class{};
+    std::vector<Finalizer> _finalizers{};
+    std::shared_ptr<napi_env__::callback_queue> _queue{};
   };
 
   class ExternalInfo: public BaseInfoT<ExternalInfo, NativeType::External> {
@@ -557,35 +2193,50 @@ namespace {
       info->Data(data);
 
       if (finalize_cb != nullptr) {
-        info->AddFinalizer([finalize_cb, finalize_hint](ExternalInfo* info) {
-          finalize_cb(info->Env(), info->Data(), finalize_hint);
-        });
+        info->AddFinalizer(finalize_cb, data, finalize_hint);
       }
 
-      *result = ToNapi(JSObjectMake(env->context, info->_class, info));
+      *result = ToNapi(JSObjectMake(env->context, Class<ExternalInfo>(env), info));
       return napi_ok;
     }
 
    private:
+    friend class NativeInfo;
+    static constexpr const char* ClassName = "Native (External)";
+
     ExternalInfo(napi_env env)
-      : BaseInfoT{env, "Native (External)"} {
+      : BaseInfoT{env} {
     }
   };
 
+  // Native state attached to an arbitrary JS object: the napi_wrap pointer and
+  // finalizers from napi_add_finalizer. Released when the object is collected.
   class WrapperInfo : public BaseInfoT<WrapperInfo, NativeType::Wrapper> {
    public:
+    // The WrapperInfo lives on a native holder object that the env's WeakMap
+    // associates with the wrapped object, so it's collected along with the
+    // object. Nothing is stored on the object itself: wrapping works on
+    // frozen objects, stays invisible to JS, and doesn't go through proxy
+    // traps.
     static napi_status Wrap(napi_env env, napi_value object, WrapperInfo** result) {
       WrapperInfo* info{};
       CHECK_NAPI(Unwrap(env, object, &info));
       if (info == nullptr) {
+        JSObjectRef map{};
+        CHECK_NAPI(Map(env, &map));
+        JSObjectRef set{};
+        CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMapPrototypeSet, &set));
+
         info = new WrapperInfo(env);
         if (info == nullptr) {
           return napi_set_last_error(env, napi_generic_failure);
         }
 
-        JSObjectRef prototype{JSObjectMake(env->context, info->_class, info)};
-        JSObjectSetPrototype(env->context, prototype, JSObjectGetPrototype(env->context, ToJSObject(env, object)));
-        JSObjectSetPrototype(env->context, ToJSObject(env, object), prototype);
+        // If the call fails, the orphaned holder is finalized by the GC.
+        JSValueRef args[]{ToJSValue(object), JSObjectMake(env->context, Class<WrapperInfo>(env), info)};
+        JSValueRef exception{};
+        JSObjectCallAsFunction(env->context, set, map, std::size(args), args, &exception);
+        CHECK_JSC(env, exception);
       }
 
       *result = info;
@@ -593,14 +2244,68 @@ namespace {
     }
 
     static napi_status Unwrap(napi_env env, napi_value object, WrapperInfo** result) {
-      *result = NativeInfo::FindInPrototypeChain<WrapperInfo>(env->context, ToJSObject(env, object));
+      RETURN_STATUS_IF_FALSE(env, JSValueIsObject(env->context, ToJSValue(object)), napi_object_expected);
+
+      *result = nullptr;
+      if (env->wrap_map == nullptr) {
+        return napi_ok;
+      }
+
+      JSObjectRef get{};
+      CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMapPrototypeGet, &get));
+      JSValueRef args[]{ToJSValue(object)};
+      JSValueRef exception{};
+      JSValueRef holder{JSObjectCallAsFunction(env->context, get, env->wrap_map, std::size(args), args, &exception)};
+      CHECK_JSC(env, exception);
+
+      if (JSValueIsObject(env->context, holder)) {
+        *result = NativeInfo::GetOfType<WrapperInfo>(ToJSObject(env, ToNapi(holder)));
+      }
       return napi_ok;
     }
 
+    // Finalizer for the napi_wrap pointer. Unlike AddFinalizer it's dropped by
+    // napi_remove_wrap.
+    void WrapFinalizer(napi_finalize cb, void* hint) {
+      _wrap_cb = cb;
+      _wrap_hint = hint;
+      if (cb != nullptr) {
+        Arm();
+      }
+    }
+
    private:
+    friend class NativeInfo;
+    friend class BaseInfoT;
+    static constexpr const char* ClassName = "Native (Wrapper)";
+
     WrapperInfo(napi_env env)
-      : BaseInfoT{env, "Native (Wrapper)"} {
+      : BaseInfoT{env} {
     }
+
+    static napi_status Map(napi_env env, JSObjectRef* result) {
+      if (env->wrap_map == nullptr) {
+        JSObjectRef constructor{};
+        CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMap, &constructor));
+        JSValueRef exception{};
+        JSObjectRef map{JSObjectCallAsConstructor(env->context, constructor, 0, nullptr, &exception)};
+        CHECK_JSC(env, exception);
+        JSValueProtect(env->context, map);
+        env->wrap_map = map;
+      }
+      *result = env->wrap_map;
+      return napi_ok;
+    }
+
+    void TakeFinalizers() {
+      if (_wrap_cb != nullptr) {
+        _finalizers.push_back({_wrap_cb, Data(), _wrap_hint});
+        _wrap_cb = nullptr;
+      }
+    }
+
+    napi_finalize _wrap_cb{};
+    void* _wrap_hint{};
   };
 
   class ExternalArrayBufferInfo {
@@ -611,10 +2316,13 @@ namespace {
                               napi_finalize finalize_cb,
                               void* finalize_hint,
                               napi_value* result) {
-      ExternalArrayBufferInfo* info{new ExternalArrayBufferInfo(env, finalize_cb, finalize_hint)};
-      if (info == nullptr) {
+      // Allocated from the env's pool, since these are as short-lived as the
+      // buffers they belong to.
+      void* storage{env->arraybuffers->allocate(sizeof(ExternalArrayBufferInfo))};
+      if (storage == nullptr) {
         return napi_set_last_error(env, napi_generic_failure);
       }
+      ExternalArrayBufferInfo* info{new (storage) ExternalArrayBufferInfo(env, external_data, finalize_cb, finalize_hint)};
 
       JSValueRef exception{};
       *result = ToNapi(JSObjectMakeArrayBufferWithBytesNoCopy(
@@ -624,14 +2332,20 @@ namespace {
         BytesDeallocator,
         info,
         &exception));
+      // JSC counts the bytes of NoCopy buffers towards GC pressure itself, so
+      // unlike napi_adjust_external_memory there's nothing to report.
       CHECK_JSC(env, exception);
-
+      if (finalize_cb != nullptr) {
+        info->_queue = env->finalizers;
+        info->_queue->arm(info, RunArmedFinalizer);
+      }
       return napi_ok;
     }
 
    private:
-    ExternalArrayBufferInfo(napi_env env, napi_finalize finalize_cb, void* hint)
+    ExternalArrayBufferInfo(napi_env env, void* bytes, napi_finalize finalize_cb, void* hint)
       : _env{env}
+      , _bytes{bytes}
       , _cb{finalize_cb}
       , _hint{hint} {
     }
@@ -639,93 +2353,92 @@ namespace {
     // JSTypedArrayBytesDeallocator
     static void BytesDeallocator(void* bytes, void* deallocatorContext) {
       ExternalArrayBufferInfo* info{reinterpret_cast<ExternalArrayBufferInfo*>(deallocatorContext)};
-      if (info->_cb != nullptr) {
-        info->_cb(info->_env, bytes, info->_hint);
+      // Like other finalizers, the callback runs on the executor rather than
+      // in the middle of a collection, unless the env has already run it.
+      if (info->_queue == nullptr || !info->_queue->post(info, RunFinalizer)) {
+        Destroy(info);
       }
-      delete info;
     }
 
-    napi_env _env;
-    napi_finalize _cb;
-    void* _hint;
-  };
-}
-
-static napi_value finalizer_cb(napi_env env, napi_callback_info info) {
-  napi_value undefined;
-  napi_get_undefined(env, &undefined);
-
-  void *external = nullptr;
-  if (napi_get_value_external(env, info->argv[0], &external) != napi_ok || !external) return undefined;
-
-  (*static_cast<std::function<void(void)> *>(external))();
+    static void RunFinalizer(void* data) {
+      ExternalArrayBufferInfo* info{static_cast<ExternalArrayBufferInfo*>(data)};
+      RunArmedFinalizer(info);
+      Destroy(info);
+    }
 
-  return undefined;
-}
+    static void RunArmedFinalizer(void* data) {
+      ExternalArrayBufferInfo* info{static_cast<ExternalArrayBufferInfo*>(data)};
+      info->_cb(info->_env, info->_bytes, info->_hint);
+    }
 
-static void finalizer_data_cb(napi_env env, void *finalize_data, void *finalize_hint) {
-  delete static_cast<std::function<void(void)> *>(finalize_data);
-}
+    static void Destroy(ExternalArrayBufferInfo* info) {
+      info->~ExternalArrayBufferInfo();
+      napi_env__::arraybuffer_pool::deallocate(info);
+    }
 
-static napi_status add_finalizer(napi_env env, napi_value value, std::function<void(void)> did_finalize) {
-  napi_value registry;
-  if (env->finalization_registry) {
-    registry = ToNapi(env->finalization_registry);
-  } else {
-    napi_value global{}, registry_ctor{}, registry_cb{}, registry_{};
-    CHECK_NAPI(napi_get_global(env, &global));
-    CHECK_NAPI(napi_get_named_property(env, global, "FinalizationRegistry", &registry_ctor));
-    CHECK_NAPI(napi_create_function(env, "", 0, finalizer_cb, nullptr, &registry_cb));
-    CHECK_NAPI(napi_new_instance(env, registry_ctor, 1, &registry_cb, &registry_));
-    JSValueRef js_registry = ToJSValue(registry_);
-    JSValueProtect(env->context, js_registry);
-    env->finalization_registry = js_registry;
-    registry = registry_;
-  }
-  napi_value register_fn{}, ext{};
-  CHECK_NAPI(napi_get_named_property(env, registry, "register", &register_fn));
-  void *finalizer_data = new std::function<void(void)> { std::move(did_finalize) };
-  CHECK_NAPI(napi_create_external(env, finalizer_data, finalizer_data_cb, nullptr, &ext));
-  napi_value args[] { value, ext };
-  CHECK_NAPI(napi_call_function(env, registry, register_fn, 2, args, nullptr));
-  return napi_ok;
+    napi_env _env;
+    void* _bytes;
+    napi_finalize _cb;
+    void* _hint;
+    std::shared_ptr<napi_env__::callback_queue> _queue{};
+  };
 }
 
+// A slot in the env's ref table. Strong references hold their value in the
+// env's root array. Weak references to objects are kept in the env's
+// JSWeakObjectMap, keyed by the napi_ref itself, which the GC clears as soon
+// as the object is found to be dead. Primitives can't be held weakly and stay
+// in the root array for the lifetime of the reference.
 struct napi_ref__ {
-  napi_ref__(napi_env env, napi_value value, uint32_t count)
-  : _value{value}, _count{count}, _has_deleted{std::make_shared<bool>(false)} {
+  void init(napi_env env, napi_value value, uint32_t count) {
+    _value = value;
+    _count = count;
     if (_count != 0) {
-      protect(env);
+      hold(env);
+    } else {
+      track(env);
     }
-
-    // we use has_deleted to signal that the napi_ref has been `delete`d
-    // via napi_delete_reference. If the ref has been deleted, setting
-    // this->_value=nullptr would be a UAF (and would be redundant) so
-    // we skip it in that case.
-    add_finalizer(env, _value, [has_deleted=_has_deleted, self=this] {
-      if (!has_deleted) self->_value = nullptr;
-    });
   }
 
   void deinit(napi_env env) {
-    if (_count != 0) {
-      unprotect(env);
+    if (_strong) {
+      release(env);
+    } else if (_weak) {
+      JSWeakObjectMapRemove(env->context, env->weak_refs(), this);
+    } else if (_pinned) {
+      env->drop_ref(_index);
     }
 
-    *_has_deleted = true;
     _value = nullptr;
     _count = 0;
+    _weak = false;
+    _pinned = false;
   }
 
   void ref(napi_env env) {
-    if (_count++ == 0) {
-      protect(env);
+    if (_count++ != 0) {
+      return;
+    }
+
+    if (_weak) {
+      _value = value(env);
+      JSWeakObjectMapRemove(env->context, env->weak_refs(), this);
+      _weak = false;
+      if (_value != nullptr) {
+        hold(env);
+      }
+    } else if (_pinned) {
+      // Already in the root array.
+      _pinned = false;
+      ++env->strong_ref_count;
+      _strong = true;
     }
   }
 
   void unref(napi_env env) {
-    if (--_count == 0) {
-      unprotect(env);
+    if (--_count == 0 && _strong) {
+      release(env);
+      track(env);
     }
   }
 
@@ -734,50 +2447,268 @@ struct napi_ref__ {
   }
 
   napi_value value(napi_env env) const {
+    if (_weak) {
+      return ToNapi(JSWeakObjectMapGet(env->context, env->weak_refs(), const_cast<napi_ref__*>(this)));
+    }
     return _value;
   }
 
  private:
-  void protect(napi_env env) {
-    _iter = env->strong_refs.insert(env->strong_refs.end(), this);
-    JSValueProtect(env->context, ToJSValue(_value));
+  friend struct napi_env__;
+
+  void hold(napi_env env) {
+    env->hold_ref(_index, _value);
+    ++env->strong_ref_count;
+    _strong = true;
   }
 
-  void unprotect(napi_env env) {
-    env->strong_refs.erase(_iter);
-    JSValueUnprotect(env->context, ToJSValue(_value));
+  void release(napi_env env) {
+    env->drop_ref(_index);
+    --env->strong_ref_count;
+    _strong = false;
     env->check_empty();
   }
 
+  void track(napi_env env) {
+    if (_pinned || _value == nullptr) {
+      return;
+    }
+
+    if (JSValueIsObject(env->context, ToJSValue(_value))) {
+      JSWeakObjectMapSet(env->context, env->weak_refs(), this, ToJSObject(env, _value));
+      _weak = true;
+    } else {
+      env->hold_ref(_index, _value);
+      _pinned = true;
+    }
+  }
+
+  // Only meaningful while the reference isn't weak.
   napi_value _value{};
-  std::shared_ptr<bool> _has_deleted;
   uint32_t _count{};
-  std::list<napi_ref>::iterator _iter{};
+  uint32_t _index{};
+  bool _strong{};
+  bool _weak{};
+  bool _pinned{};
+  napi_ref _next_free{};
 };
 
+// Calls from any thread are appended to `queue` under the mutex. Only the
+// first call into an empty queue wakes the executor; the drain then swaps the
+// whole batch out and runs it on the JS thread.
 struct napi_threadsafe_function__ {
   napi_env env;
   std::mutex mutex;
+  // Signalled when the queue has been drained or the function is closing.
+  std::condition_variable space_available;
   int64_t refcount;
+  bool aborted;
+
+  // 0 means unbounded.
+  size_t max_queue_size;
+  std::vector<void*> queue;
+  bool drain_scheduled;
+  // Only touched by the drain, so that both buffers keep their capacity.
+  std::vector<void*> draining;
+  // Callers blocked in napi_call_threadsafe_function, and callers handing a
+  // drain to the executor. Once the function has been finalized, whoever
+  // leaves last deletes it. See is_unused.
+  size_t waiters;
+  size_t dispatching;
+  std::condition_variable dispatched;
+  bool finalized;
 
   void *context;
 
   void* thread_finalize_data;
   napi_finalize thread_finalize_cb;
 
-  napi_value js_value;
+  JSValueRef js_value;
   napi_threadsafe_function_call_js call_js_cb;
 };
 
+static void abort_threadsafe_function(napi_threadsafe_function fn);
+
+// The resolving functions of a pending promise. Both are protected until
+// the deferred is settled.
+struct napi_deferred__ {
+  JSObjectRef resolve;
+  JSObjectRef reject;
+};
+
+napi_env__::~napi_env__() {
+  // Finalizers that run during teardown mustn't schedule another deletion.
+  is_deleting = true;
+  deinit_refs();
+  for (callback_queue* queue : {finalizers.get(), completions.get()}) {
+    std::lock_guard lock(queue->mutex);
+    queue->env = nullptr;
+  }
+  if (tag_map != nullptr) {
+    JSValueUnprotect(context, tag_map);
+  }
+  if (wrap_map != nullptr) {
+    JSValueUnprotect(context, wrap_map);
+  }
+  if (buffer_pool != nullptr) {
+    JSValueUnprotect(context, buffer_pool);
+  }
+  for (JSValueRef intrinsic : intrinsics) {
+    if (intrinsic != nullptr) {
+      JSValueUnprotect(context, intrinsic);
+    }
+  }
+  for (JSValueRef helper : helpers) {
+    if (helper != nullptr) {
+      JSValueUnprotect(context, helper);
+    }
+  }
+  for (JSClassRef native_class : native_classes) {
+    if (native_class != nullptr) {
+      JSClassRelease(native_class);
+    }
+  }
+  // A context that isn't in a pool holds the last reference to its VM.
+  scripts.clear();
+  property_keys.clear();
+  measured_string.clear(context);
+  JSGlobalContextRelease(context);
+  arraybuffers->close();
+  if (pool != nullptr) {
+    {
+      std::lock_guard lock(pool->mutex);
+      ++pool->envs_deleted;
+    }
+    pool->replenish_async();
+    pool->release();
+  }
+  executor.free(executor.context);
+}
+
+napi_ref napi_env__::alloc_ref() {
+  if (free_refs == nullptr) {
+    uint32_t base{static_cast<uint32_t>(ref_chunks.size()) * ref_chunk_size};
+    napi_ref chunk{ref_chunks.emplace_back(new napi_ref__[ref_chunk_size]).get()};
+    for (uint32_t i = ref_chunk_size; i-- > 0;) {
+      chunk[i]._index = base + i;
+      chunk[i]._next_free = free_refs;
+      free_refs = &chunk[i];
+    }
+  }
+
+  napi_ref ref{free_refs};
+  free_refs = ref->_next_free;
+  ref->_next_free = nullptr;
+  return ref;
+}
+
+void napi_env__::free_ref(napi_ref ref) {
+  ref->_next_free = free_refs;
+  free_refs = ref;
+}
+
+void napi_env__::hold_ref(uint32_t index, napi_value value) {
+  if (ref_root == nullptr) {
+    ref_root = JSObjectMakeArray(context, 0, nullptr, nullptr);
+    JSValueProtect(context, ref_root);
+  }
+  JSObjectSetPropertyAtIndex(context, ref_root, index, ToJSValue(value), nullptr);
+}
+
+void napi_env__::drop_ref(uint32_t index) {
+  JSObjectSetPropertyAtIndex(context, ref_root, index, JSValueMakeUndefined(context), nullptr);
+}
+
 void napi_env__::deinit_refs() {
   for (auto &[hook, args] : cleanup_hooks) {
     for (auto &arg : args) hook(arg);
   }
   cleanup_hooks.clear();
-  while (!strong_refs.empty()) {
-    napi_ref ref{strong_refs.front()};
-    ref->deinit(this);
+  // Every strong value hangs off the root, so releasing it releases them all.
+  // The slots themselves go away with ref_chunks.
+  if (ref_root != nullptr) {
+    JSValueUnprotect(context, ref_root);
+    ref_root = nullptr;
+  }
+  strong_ref_count = 0;
+  // Contexts in a pool share their VM with the envs that come after them,
+  // so anything still protected would keep this env's global object alive.
+  for (napi_deferred deferred : deferreds) {
+    JSValueUnprotect(context, deferred->resolve);
+    JSValueUnprotect(context, deferred->reject);
+    delete deferred;
+  }
+  deferreds.clear();
+  // Unref'd threadsafe functions don't keep the env alive, but their
+  // finalizers still have to run.
+  std::vector<void*> tsfns(all_tsfns.begin(), all_tsfns.end());
+  for (void* tsfn : tsfns) {
+    abort_threadsafe_function(static_cast<napi_threadsafe_function>(tsfn));
+  }
+  // Objects with native finalizers may outlive the env, so those run now
+  // rather than whenever the objects are collected.
+  finalizers->finalize_all();
+  for (instance_data& slot : instance_data_slots) {
+    if (slot.finalize_cb != nullptr) {
+      slot.finalize_cb(this, slot.data, slot.finalize_hint);
+    }
+    slot = {};
+  }
+}
+
+napi_env__::property_key_cache::key napi_env__::property_key_cache::get(const char* name) {
+  pointer_slot& slot{by_pointer[(reinterpret_cast<uintptr_t>(name) >> 3) % pointer_slots]};
+  // Only names without embedded nulls get a slot, so strcmp is exact.
+  if (slot.name == name && std::strcmp(slot.it->name.c_str(), name) == 0) {
+    ++pointer_hits;
+    entries.splice(entries.begin(), entries, slot.it);
+    return key{slot.it->string};
+  }
+
+  auto it{find_or_insert(name, nullptr, 0)};
+  slot = {name, it};
+  return key{it->string};
+}
+
+napi_env__::property_key_cache::key
+napi_env__::property_key_cache::get(std::string_view name, const JSChar* chars, size_t length) {
+  return key{find_or_insert(name, chars, length)->string};
+}
+
+std::list<napi_env__::property_key_cache::entry>::iterator
+napi_env__::property_key_cache::find_or_insert(std::string_view name, const JSChar* chars, size_t length) {
+  auto found{index.find(name)};
+  if (found != index.end()) {
+    ++name_hits;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second;
+  }
+
+  ++misses;
+  if (entries.size() == capacity) {
+    erase(std::prev(entries.end()));
+  }
+  JSStringRef string{};
+  if (chars != nullptr) {
+    string = JSStringCreateWithCharacters(chars, length);
+  } else {
+    JSString created{name.data(), name.size()};
+    string = JSStringRetain(created);
+  }
+  entries.push_front({std::string{name}, string});
+  index.emplace(entries.front().name, entries.begin());
+  return entries.begin();
+}
+
+void napi_env__::property_key_cache::erase(std::list<entry>::iterator it) {
+  for (pointer_slot& slot : by_pointer) {
+    if (slot.name != nullptr && slot.it == it) {
+      slot = {};
+    }
   }
+  JSStringRelease(it->string);
+  index.erase(it->name);
+  entries.erase(it);
 }
 
 // Warning: Keep in-sync with napi_status enum
@@ -800,10 +2731,17 @@ static const char* error_messages[] = {
   "Thread-safe function queue is full",
   "Thread-safe function handle is closing",
   "A bigint was expected",
+  "A date was expected",
+  "An arraybuffer was expected",
+  "A detachable arraybuffer was expected",
+  "Main thread would deadlock",
+  "External buffers are not allowed",
+  "Cannot run JavaScript",
 };
 
 napi_status napi_get_last_error_info(napi_env env,
                                      const napi_extended_error_info** result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -812,9 +2750,9 @@ napi_status napi_get_last_error_info(napi_env env,
   // We don't have a napi_status_last as this would result in an ABI
   // change each time a message was added.
   static_assert(
-    std::size(error_messages) == napi_bigint_expected + 1,
+    std::size(error_messages) == napi_cannot_run_js + 1,
     "Count of error messages must match count of error values");
-  assert(env->last_error.error_code <= napi_callback_scope_mismatch);
+  assert(env->last_error.error_code <= napi_cannot_run_js);
 
   // Wait until someone requests the last error information to fetch the error
   // message string
@@ -831,6 +2769,7 @@ napi_status napi_create_function(napi_env env,
                                  napi_callback cb,
                                  void* callback_data,
                                  napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -846,6 +2785,7 @@ napi_status napi_define_class(napi_env env,
                               size_t property_count,
                               const napi_property_descriptor* properties,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -884,7 +2824,7 @@ napi_status napi_define_class(napi_env env,
 
   if (instancePropertyCount > 0) {
     napi_value prototype{};
-    CHECK_NAPI(napi_get_prototype(env, constructor, &prototype));
+    CHECK_NAPI(napi_get_named_property(env, constructor, "prototype", &prototype));
 
     CHECK_NAPI(napi_define_properties(env,
                                       prototype,
@@ -899,22 +2839,20 @@ napi_status napi_define_class(napi_env env,
 napi_status napi_get_property_names(napi_env env,
                                     napi_value object,
                                     napi_value* result) {
-  CHECK_ENV(env);
-  CHECK_ARG(env, result);
-
-  napi_value global{}, object_ctor{}, function{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-  CHECK_NAPI(napi_get_named_property(env, object_ctor, "getOwnPropertyNames", &function));
-  CHECK_NAPI(napi_call_function(env, object_ctor, function, 1, &object, result));
-
-  return napi_ok;
+  RECORD_CALL();
+  return napi_get_all_property_names(env,
+                                     object,
+                                     napi_key_include_prototypes,
+                                     static_cast<napi_key_filter>(napi_key_enumerable | napi_key_skip_symbols),
+                                     napi_key_numbers_to_strings,
+                                     result);
 }
 
 napi_status napi_set_property(napi_env env,
                               napi_value object,
                               napi_value key,
                               napi_value value) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, key);
   CHECK_ARG(env, value);
@@ -939,6 +2877,7 @@ napi_status napi_has_property(napi_env env,
                               napi_value object,
                               napi_value key,
                               bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   CHECK_ARG(env, key);
@@ -958,6 +2897,7 @@ napi_status napi_get_property(napi_env env,
                               napi_value object,
                               napi_value key,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, key);
   CHECK_ARG(env, result);
@@ -980,6 +2920,7 @@ napi_status napi_delete_property(napi_env env,
                                  napi_value object,
                                  napi_value key,
                                  bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1001,14 +2942,15 @@ NAPI_EXTERN napi_status napi_has_own_property(napi_env env,
                                               napi_value object,
                                               napi_value key,
                                               bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
+  CHECK_ARG(env, key);
   CHECK_ARG(env, result);
 
-  napi_value global{}, object_ctor{}, function{}, value{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-  CHECK_NAPI(napi_get_named_property(env, object_ctor, "hasOwnProperty", &function));
-  CHECK_NAPI(napi_call_function(env, object_ctor, function, 1, &object, &value));
+  // Object.prototype.hasOwnProperty.call(object, key)
+  napi_value function{}, value{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::ObjectPrototypeHasOwnProperty, &function));
+  CHECK_NAPI(napi_call_function(env, object, function, 1, &key, &value));
   *result = JSValueToBoolean(env->context, ToJSValue(value));
 
   return napi_ok;
@@ -1018,14 +2960,17 @@ napi_status napi_set_named_property(napi_env env,
                                     napi_value object,
                                     const char* utf8name,
                                     napi_value value) {
+  RECORD_CALL();
   CHECK_ENV(env);
+  CHECK_ARG(env, object);
+  CHECK_ARG(env, utf8name);
   CHECK_ARG(env, value);
 
   JSValueRef exception{};
   JSObjectSetProperty(
     env->context,
     ToJSObject(env, object),
-    JSString(utf8name),
+    env->property_keys.get(utf8name),
     ToJSValue(value),
     kJSPropertyAttributeNone,
     &exception);
@@ -1038,13 +2983,16 @@ napi_status napi_has_named_property(napi_env env,
                                     napi_value object,
                                     const char* utf8name,
                                     bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, object);
+  CHECK_ARG(env, utf8name);
+  CHECK_ARG(env, result);
 
   *result = JSObjectHasProperty(
     env->context,
     ToJSObject(env, object),
-    JSString(utf8name));
+    env->property_keys.get(utf8name));
 
   return napi_ok;
 }
@@ -1053,14 +3001,17 @@ napi_status napi_get_named_property(napi_env env,
                                     napi_value object,
                                     const char* utf8name,
                                     napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, object);
+  CHECK_ARG(env, utf8name);
+  CHECK_ARG(env, result);
 
   JSValueRef exception{};
   *result = ToNapi(JSObjectGetProperty(
     env->context,
     ToJSObject(env, object),
-    JSString(utf8name),
+    env->property_keys.get(utf8name),
     &exception));
   CHECK_JSC(env, exception);
 
@@ -1071,6 +3022,7 @@ napi_status napi_set_element(napi_env env,
                              napi_value object,
                              uint32_t index,
                              napi_value value) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
 
@@ -1090,6 +3042,7 @@ napi_status napi_has_element(napi_env env,
                              napi_value object,
                              uint32_t index,
                              bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1109,6 +3062,7 @@ napi_status napi_get_element(napi_env env,
                              napi_value object,
                              uint32_t index,
                              napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1127,6 +3081,7 @@ napi_status napi_delete_element(napi_env env,
                                 napi_value object,
                                 uint32_t index,
                                 bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1150,70 +3105,92 @@ napi_status napi_define_properties(napi_env env,
                                    napi_value object,
                                    size_t property_count,
                                    const napi_property_descriptor* properties) {
+  RECORD_CALL();
   CHECK_ENV(env);
   if (property_count > 0) {
     CHECK_ARG(env, properties);
   }
 
+  JSObjectRef target{ToJSObject(env, object)};
+
+  // Properties are defined one at a time, in order. Data properties and
+  // methods whose names don't exist on the object yet are set directly with
+  // the matching attributes; accessors and redefinitions go through the
+  // DefineProperty helper.
   for (size_t i = 0; i < property_count; i++) {
     const napi_property_descriptor* p{properties + i};
 
-    napi_value descriptor{};
-    CHECK_NAPI(napi_create_object(env, &descriptor));
-
-    napi_value configurable{};
-    CHECK_NAPI(napi_get_boolean(env, (p->attributes & napi_configurable), &configurable));
-    CHECK_NAPI(napi_set_named_property(env, descriptor, "configurable", configurable));
-
-    napi_value enumerable{};
-    CHECK_NAPI(napi_get_boolean(env, (p->attributes & napi_configurable), &enumerable));
-    CHECK_NAPI(napi_set_named_property(env, descriptor, "enumerable", enumerable));
+    JSValueRef key{};
+    if (p->utf8name != nullptr) {
+      key = JSValueMakeString(env->context, env->property_keys.get(p->utf8name));
+    } else {
+      RETURN_STATUS_IF_FALSE(env, p->name != nullptr, napi_name_expected);
+      key = ToJSValue(p->name);
+    }
 
-    if (p->getter != nullptr || p->setter != nullptr) {
-      if (p->getter != nullptr) {
-        napi_value getter{};
-        CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->getter, p->data, &getter));
-        CHECK_NAPI(napi_set_named_property(env, descriptor, "get", getter));
-      }
-      if (p->setter != nullptr) {
-        napi_value setter{};
-        CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->setter, p->data, &setter));
-        CHECK_NAPI(napi_set_named_property(env, descriptor, "set", setter));
+    JSValueRef exception{};
+    JSValueRef value{};
+    if (p->getter == nullptr && p->setter == nullptr) {
+      if (p->method != nullptr) {
+        napi_value method{};
+        CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->method, p->data, &method));
+        value = ToJSValue(method);
+      } else {
+        RETURN_STATUS_IF_FALSE(env, p->value != nullptr, napi_invalid_arg);
+        value = ToJSValue(p->value);
       }
-    } else if (p->method != nullptr) {
-      napi_value method{};
-      CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->method, p->data, &method));
-      CHECK_NAPI(napi_set_named_property(env, descriptor, "value", method));
-    } else {
-      RETURN_STATUS_IF_FALSE(env, p->value != nullptr, napi_invalid_arg);
 
-      napi_value writable{};
-      CHECK_NAPI(napi_get_boolean(env, (p->attributes & napi_writable), &writable));
-      CHECK_NAPI(napi_set_named_property(env, descriptor, "writable", writable));
+      bool exists{JSObjectHasPropertyForKey(env->context, target, key, &exception)};
+      CHECK_JSC(env, exception);
 
-      CHECK_NAPI(napi_set_named_property(env, descriptor, "value", p->value));
-    }
+      if (!exists) {
+        JSPropertyAttributes attributes{kJSPropertyAttributeNone};
+        if ((p->attributes & napi_writable) == 0) {
+          attributes |= kJSPropertyAttributeReadOnly;
+        }
+        if ((p->attributes & napi_enumerable) == 0) {
+          attributes |= kJSPropertyAttributeDontEnum;
+        }
+        if ((p->attributes & napi_configurable) == 0) {
+          attributes |= kJSPropertyAttributeDontDelete;
+        }
 
-    napi_value propertyName{};
-    if (p->utf8name == nullptr) {
-      propertyName = p->name;
-    } else {
-      CHECK_NAPI(napi_create_string_utf8(env, p->utf8name, NAPI_AUTO_LENGTH, &propertyName));
+        JSObjectSetPropertyForKey(env->context, target, key, value, attributes, &exception);
+        CHECK_JSC(env, exception);
+        // The set fails silently on objects that aren't extensible.
+        bool defined{JSObjectHasPropertyForKey(env->context, target, key, &exception)};
+        CHECK_JSC(env, exception);
+        RETURN_STATUS_IF_FALSE(env, defined, napi_invalid_arg);
+        continue;
+      }
     }
 
-    napi_value global{}, object_ctor{}, function{};
-    CHECK_NAPI(napi_get_global(env, &global));
-    CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-    CHECK_NAPI(napi_get_named_property(env, object_ctor, "defineProperty", &function));
+    JSValueRef undefined{JSValueMakeUndefined(env->context)};
+    JSValueRef args[]{target, key, JSValueMakeNumber(env->context, p->attributes),
+      value != nullptr ? value : undefined, undefined, undefined};
+    if (p->getter != nullptr) {
+      napi_value getter{};
+      CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->getter, p->data, &getter));
+      args[4] = ToJSValue(getter);
+    }
+    if (p->setter != nullptr) {
+      napi_value setter{};
+      CHECK_NAPI(napi_create_function(env, p->utf8name, NAPI_AUTO_LENGTH, p->setter, p->data, &setter));
+      args[5] = ToJSValue(setter);
+    }
 
-    napi_value args[] = { object, propertyName, descriptor };
-    CHECK_NAPI(napi_call_function(env, object_ctor, function, 3, args, nullptr));
+    JSObjectRef define_property{};
+    CHECK_NAPI(GetHelper(env, Helper::DefineProperty, &define_property));
+    JSValueRef defined{JSObjectCallAsFunction(env->context, define_property, nullptr, std::size(args), args, &exception)};
+    CHECK_JSC(env, exception);
+    RETURN_STATUS_IF_FALSE(env, JSValueToBoolean(env->context, defined), napi_invalid_arg);
   }
 
   return napi_ok;
 }
 
 napi_status napi_is_array(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1227,6 +3204,7 @@ napi_status napi_is_array(napi_env env, napi_value value, bool* result) {
 napi_status napi_get_array_length(napi_env env,
                                   napi_value value,
                                   uint32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1249,6 +3227,7 @@ napi_status napi_strict_equals(napi_env env,
                                napi_value lhs,
                                napi_value rhs,
                                bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, lhs);
   CHECK_ARG(env, rhs);
@@ -1263,6 +3242,7 @@ napi_status napi_strict_equals(napi_env env,
 napi_status napi_get_prototype(napi_env env,
                                napi_value object,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1275,6 +3255,7 @@ napi_status napi_get_prototype(napi_env env,
 }
 
 napi_status napi_create_object(napi_env env, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSObjectMake(env->context, nullptr, nullptr));
@@ -1282,6 +3263,7 @@ napi_status napi_create_object(napi_env env, napi_value* result) {
 }
 
 napi_status napi_create_array(napi_env env, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1295,6 +3277,7 @@ napi_status napi_create_array(napi_env env, napi_value* result) {
 napi_status napi_create_array_with_length(napi_env env,
                                           size_t length,
                                           napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1323,11 +3306,12 @@ napi_status napi_create_string_latin1(napi_env env,
                                       const char* str,
                                       size_t length,
                                       napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeString(
     env->context,
-    JSString(str, length)));
+    JSString::Latin1(str, length)));
   return napi_ok;
 }
 
@@ -1335,6 +3319,7 @@ napi_status napi_create_string_utf8(napi_env env,
                                     const char* str,
                                     size_t length,
                                     napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeString(
@@ -1347,6 +3332,7 @@ napi_status napi_create_string_utf16(napi_env env,
                                      const char16_t* str,
                                      size_t length,
                                      napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   static_assert(sizeof(char16_t) == sizeof(JSChar));
@@ -1356,9 +3342,117 @@ napi_status napi_create_string_utf16(napi_env env,
   return napi_ok;
 }
 
+// JSC has no external strings. JSStringCreateWithCharactersNoCopy is SPI
+// (JSStringRefPrivate.h), and it takes no deallocator, so nothing would say
+// when the last JS string using the buffer is gone and finalize_callback
+// could never be called. These copy, like Node does for strings too short to
+// be worth externalizing, report *copied = true, and finalize right away.
+static napi_status finalize_copied_string(napi_env env,
+                                          void* str,
+                                          napi_finalize finalize_callback,
+                                          void* finalize_hint,
+                                          bool* copied) {
+  if (copied != nullptr) {
+    *copied = true;
+  }
+  if (finalize_callback != nullptr) {
+    finalize_callback(env, str, finalize_hint);
+  }
+  return napi_ok;
+}
+
+napi_status node_api_create_external_string_latin1(napi_env env,
+                                                   char* str,
+                                                   size_t length,
+                                                   napi_finalize finalize_callback,
+                                                   void* finalize_hint,
+                                                   napi_value* result,
+                                                   bool* copied) {
+  RECORD_CALL();
+  CHECK_NAPI(napi_create_string_latin1(env, str, length, result));
+  return finalize_copied_string(env, str, finalize_callback, finalize_hint, copied);
+}
+
+napi_status node_api_create_external_string_utf16(napi_env env,
+                                                  char16_t* str,
+                                                  size_t length,
+                                                  napi_finalize finalize_callback,
+                                                  void* finalize_hint,
+                                                  napi_value* result,
+                                                  bool* copied) {
+  RECORD_CALL();
+  CHECK_NAPI(napi_create_string_utf16(env, str, length, result));
+  return finalize_copied_string(env, str, finalize_callback, finalize_hint, copied);
+}
+
+// Property keys are interned in the env's property_keys cache, keyed by
+// UTF-8, and so share entries with the named-property functions.
+napi_status node_api_create_property_key_latin1(napi_env env,
+                                                const char* str,
+                                                size_t length,
+                                                napi_value* result) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  if (length != 0) {
+    CHECK_ARG(env, str);
+  }
+  if (length == NAPI_AUTO_LENGTH) {
+    length = std::strlen(str);
+  }
+  if (ASCIIPrefixLength(str, length) != length) {
+    return napi_create_string_latin1(env, str, length, result);
+  }
+  *result = ToNapi(JSValueMakeString(env->context, env->property_keys.get({str, length})));
+  return napi_ok;
+}
+
+napi_status node_api_create_property_key_utf8(napi_env env,
+                                              const char* str,
+                                              size_t length,
+                                              napi_value* result) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  if (length != 0) {
+    CHECK_ARG(env, str);
+  }
+  if (length == NAPI_AUTO_LENGTH) {
+    length = std::strlen(str);
+  }
+  *result = ToNapi(JSValueMakeString(env->context, env->property_keys.get({str, length})));
+  return napi_ok;
+}
+
+napi_status node_api_create_property_key_utf16(napi_env env,
+                                               const char16_t* str,
+                                               size_t length,
+                                               napi_value* result) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  if (length != 0) {
+    CHECK_ARG(env, str);
+  }
+  if (length == NAPI_AUTO_LENGTH) {
+    length = std::char_traits<char16_t>::length(str);
+  }
+  const JSChar* chars{reinterpret_cast<const JSChar*>(str)};
+  // Lone surrogates don't survive the trip through UTF-8, so keys with any
+  // surrogates at all skip the cache. Property names rarely have them.
+  if (std::any_of(chars, chars + length, [](JSChar c) { return c >= 0xD800 && c <= 0xDFFF; })) {
+    return napi_create_string_utf16(env, str, length, result);
+  }
+  ScratchBuffer<char> name{length * 3};
+  size_t name_length{UTF16ToUTF8(chars, length, name.data(), length * 3)};
+  *result = ToNapi(JSValueMakeString(env->context, env->property_keys.get({name.data(), name_length}, chars, length)));
+  return napi_ok;
+}
+
 napi_status napi_create_double(napi_env env,
                                double value,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeNumber(env->context, value));
@@ -1368,6 +3462,7 @@ napi_status napi_create_double(napi_env env,
 napi_status napi_create_int32(napi_env env,
                               int32_t value,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeNumber(env->context, static_cast<double>(value)));
@@ -1377,6 +3472,7 @@ napi_status napi_create_int32(napi_env env,
 napi_status napi_create_uint32(napi_env env,
                                uint32_t value,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeNumber(env->context, static_cast<double>(value)));
@@ -1386,6 +3482,7 @@ napi_status napi_create_uint32(napi_env env,
 napi_status napi_create_int64(napi_env env,
                               int64_t value,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeNumber(env->context, static_cast<double>(value)));
@@ -1393,6 +3490,7 @@ napi_status napi_create_int64(napi_env env,
 }
 
 napi_status napi_get_boolean(napi_env env, bool value, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeBoolean(env->context, value));
@@ -1402,12 +3500,13 @@ napi_status napi_get_boolean(napi_env env, bool value, napi_value* result) {
 napi_status napi_create_symbol(napi_env env,
                                napi_value description,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
   napi_value global{}, symbol_func{};
   CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Symbol", &symbol_func));
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::Symbol, &symbol_func));
   CHECK_NAPI(napi_call_function(env, global, symbol_func, 1, &description, result));
   return napi_ok;
 }
@@ -1416,6 +3515,7 @@ napi_status napi_create_error(napi_env env,
                               napi_value code,
                               napi_value msg,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, msg);
   CHECK_ARG(env, result);
@@ -1435,13 +3535,13 @@ napi_status napi_create_type_error(napi_env env,
                                    napi_value code,
                                    napi_value msg,
                                    napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, msg);
   CHECK_ARG(env, result);
 
-  napi_value global{}, error_ctor{}, error{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "TypeError", &error_ctor));
+  napi_value error_ctor{}, error{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::TypeError, &error_ctor));
   CHECK_NAPI(napi_new_instance(env, error_ctor, 1, &msg, &error));
   CHECK_NAPI(napi_set_error_code(env, error, code, nullptr));
 
@@ -1453,13 +3553,13 @@ napi_status napi_create_range_error(napi_env env,
                                     napi_value code,
                                     napi_value msg,
                                     napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, msg);
   CHECK_ARG(env, result);
 
-  napi_value global{}, error_ctor{}, error{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "RangeError", &error_ctor));
+  napi_value error_ctor{}, error{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::RangeError, &error_ctor));
   CHECK_NAPI(napi_new_instance(env, error_ctor, 1, &msg, &error));
   CHECK_NAPI(napi_set_error_code(env, error, code, nullptr));
 
@@ -1468,11 +3568,11 @@ napi_status napi_create_range_error(napi_env env,
 }
 
 napi_status napi_typeof(napi_env env, napi_value value, napi_valuetype* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
 
-  // JSC does not support BigInt
   JSType valueType = JSValueGetType(env->context, ToJSValue(value));
   switch (valueType) {
     case kJSTypeUndefined: *result = napi_undefined; break;
@@ -1482,6 +3582,12 @@ napi_status napi_typeof(napi_env env, napi_value value, napi_valuetype* result)
     case kJSTypeString: *result = napi_string; break;
     case kJSTypeSymbol: *result = napi_symbol; break;
     default:
+      // BigInts are kJSTypeBigInt on newer versions of JSC and reported as
+      // objects by older ones. Either way they aren't JSObjects.
+      if (!JSValueIsObject(env->context, ToJSValue(value))) {
+        *result = napi_bigint;
+        break;
+      }
       JSObjectRef object{ToJSObject(env, value)};
       if (JSObjectIsFunction(env->context, object)) {
         *result = napi_function;
@@ -1500,6 +3606,7 @@ napi_status napi_typeof(napi_env env, napi_value value, napi_valuetype* result)
 }
 
 napi_status napi_get_undefined(napi_env env, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeUndefined(env->context));
@@ -1507,6 +3614,7 @@ napi_status napi_get_undefined(napi_env env, napi_value* result) {
 }
 
 napi_status napi_get_null(napi_env env, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeNull(env->context));
@@ -1520,6 +3628,7 @@ napi_status napi_get_cb_info(napi_env env,              // [in] NAPI environment
                              napi_value* argv,          // [out] Array of values
                              napi_value* this_arg,      // [out] Receives the JS 'this' arg for the call
                              void** data) {             // [out] Receives the data pointer for the callback.
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, cbinfo);
 
@@ -1558,6 +3667,7 @@ napi_status napi_get_cb_info(napi_env env,              // [in] NAPI environment
 napi_status napi_get_new_target(napi_env env,
                                 napi_callback_info cbinfo,
                                 napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, cbinfo);
   CHECK_ARG(env, result);
@@ -1572,6 +3682,7 @@ napi_status napi_call_function(napi_env env,
                                size_t argc,
                                const napi_value* argv,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, recv);
   if (argc > 0) {
@@ -1596,6 +3707,7 @@ napi_status napi_call_function(napi_env env,
 }
 
 napi_status napi_get_global(napi_env env, napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = ToNapi(JSContextGetGlobalObject(env->context));
@@ -1603,6 +3715,7 @@ napi_status napi_get_global(napi_env env, napi_value* result) {
 }
 
 napi_status napi_throw(napi_env env, napi_value error) {
+  RECORD_CALL();
   CHECK_ENV(env);
   napi_status status{napi_set_exception(env, ToJSValue(error))};
   assert(status == napi_pending_exception);
@@ -1612,6 +3725,7 @@ napi_status napi_throw(napi_env env, napi_value error) {
 napi_status napi_throw_error(napi_env env,
                              const char* code,
                              const char* msg) {
+  RECORD_CALL();
   CHECK_ENV(env);
   napi_value code_value{ToNapi(JSValueMakeString(env->context, JSString(code)))};
   napi_value msg_value{ToNapi(JSValueMakeString(env->context, JSString(msg)))};
@@ -1623,6 +3737,7 @@ napi_status napi_throw_error(napi_env env,
 napi_status napi_throw_type_error(napi_env env,
                                   const char* code,
                                   const char* msg) {
+  RECORD_CALL();
   CHECK_ENV(env);
   napi_value code_value{ToNapi(JSValueMakeString(env->context, JSString(code)))};
   napi_value msg_value{ToNapi(JSValueMakeString(env->context, JSString(msg)))};
@@ -1634,6 +3749,7 @@ napi_status napi_throw_type_error(napi_env env,
 napi_status napi_throw_range_error(napi_env env,
                                    const char* code,
                                    const char* msg) {
+  RECORD_CALL();
   CHECK_ENV(env);
   napi_value code_value{ToNapi(JSValueMakeString(env->context, JSString(code)))};
   napi_value msg_value{ToNapi(JSValueMakeString(env->context, JSString(msg)))};
@@ -1643,19 +3759,20 @@ napi_status napi_throw_range_error(napi_env env,
 }
 
 napi_status napi_is_error(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
 
-  napi_value global{}, error_ctor{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Error", &error_ctor));
+  napi_value error_ctor{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::Error, &error_ctor));
   CHECK_NAPI(napi_instanceof(env, value, error_ctor, result));
 
   return napi_ok;
 }
 
 napi_status napi_get_value_double(napi_env env, napi_value value, double* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1668,6 +3785,7 @@ napi_status napi_get_value_double(napi_env env, napi_value value, double* result
 }
 
 napi_status napi_get_value_int32(napi_env env, napi_value value, int32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1680,6 +3798,7 @@ napi_status napi_get_value_int32(napi_env env, napi_value value, int32_t* result
 }
 
 napi_status napi_get_value_uint32(napi_env env, napi_value value, uint32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1692,6 +3811,7 @@ napi_status napi_get_value_uint32(napi_env env, napi_value value, uint32_t* resu
 }
 
 napi_status napi_get_value_int64(napi_env env, napi_value value, int64_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1710,6 +3830,7 @@ napi_status napi_get_value_int64(napi_env env, napi_value value, int64_t* result
 }
 
 napi_status napi_get_value_bool(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1730,6 +3851,7 @@ napi_status napi_get_value_string_latin1(napi_env env,
                                          char* buf,
                                          size_t bufsize,
                                          size_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
 
@@ -1759,15 +3881,18 @@ napi_status napi_get_value_string_utf8(napi_env env,
                                        char* buf,
                                        size_t bufsize,
                                        size_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
 
+  JSStringRef measured{buf == nullptr ? nullptr : env->measured_string.take(env->context, ToJSValue(value))};
   JSValueRef exception{};
-  JSString string{ToJSString(env, value, &exception)};
+  JSString string{measured != nullptr ? JSString::Attach(measured) : ToJSString(env, value, &exception)};
   CHECK_JSC(env, exception);
 
   if (buf == nullptr) {
     *result = string.LengthUTF8();
+    env->measured_string.set(env->context, ToJSValue(value), string);
   } else {
     string.CopyToUTF8(buf, bufsize, result);
   }
@@ -1788,6 +3913,7 @@ napi_status napi_get_value_string_utf16(napi_env env,
                                         char16_t* buf,
                                         size_t bufsize,
                                         size_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
 
@@ -1808,6 +3934,7 @@ napi_status napi_get_value_string_utf16(napi_env env,
 napi_status napi_coerce_to_bool(napi_env env,
                                 napi_value value,
                                 napi_value* result) {
+  RECORD_CALL();
   CHECK_ARG(env, result);
   *result = ToNapi(JSValueMakeBoolean(env->context,
     JSValueToBoolean(env->context, ToJSValue(value))));
@@ -1817,6 +3944,7 @@ napi_status napi_coerce_to_bool(napi_env env,
 napi_status napi_coerce_to_number(napi_env env,
                                   napi_value value,
                                   napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1832,6 +3960,7 @@ napi_status napi_coerce_to_number(napi_env env,
 napi_status napi_coerce_to_object(napi_env env,
                                   napi_value value,
                                   napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1846,6 +3975,7 @@ napi_status napi_coerce_to_object(napi_env env,
 napi_status napi_coerce_to_string(napi_env env,
                                   napi_value value,
                                   napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1864,6 +3994,7 @@ napi_status napi_wrap(napi_env env,
                       napi_finalize finalize_cb,
                       void* finalize_hint,
                       napi_ref* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, js_object);
   if (result != nullptr) {
@@ -1875,12 +4006,7 @@ napi_status napi_wrap(napi_env env,
   RETURN_STATUS_IF_FALSE(env, info->Data() == nullptr, napi_invalid_arg);
 
   info->Data(native_object);
-
-  if (finalize_cb != nullptr) {
-    info->AddFinalizer([finalize_cb, finalize_hint](WrapperInfo* info) {
-        finalize_cb(info->Env(), info->Data(), finalize_hint);
-    });
-  }
+  info->WrapFinalizer(finalize_cb, finalize_hint);
 
   if (result != nullptr) {
     CHECK_NAPI(napi_create_reference(env, js_object, 0, result));
@@ -1890,6 +4016,7 @@ napi_status napi_wrap(napi_env env,
 }
 
 napi_status napi_unwrap(napi_env env, napi_value js_object, void** result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, js_object);
 
@@ -1902,6 +4029,7 @@ napi_status napi_unwrap(napi_env env, napi_value js_object, void** result) {
 }
 
 napi_status napi_remove_wrap(napi_env env, napi_value js_object, void** result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, js_object);
 
@@ -1910,9 +4038,12 @@ napi_status napi_remove_wrap(napi_env env, napi_value js_object, void** result)
   WrapperInfo* info{};
   CHECK_NAPI(WrapperInfo::Unwrap(env, js_object, &info));
   RETURN_STATUS_IF_FALSE(env, info != nullptr && info->Data() != nullptr, napi_invalid_arg);
-  info->Data(nullptr);
 
-  *result = info->Data();
+  if (result != nullptr) {
+    *result = info->Data();
+  }
+  info->Data(nullptr);
+  info->WrapFinalizer(nullptr, nullptr);
   return napi_ok;
 }
 
@@ -1921,6 +4052,7 @@ napi_status napi_create_external(napi_env env,
                                  napi_finalize finalize_cb,
                                  void* finalize_hint,
                                  napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -1929,6 +4061,7 @@ napi_status napi_create_external(napi_env env,
 }
 
 napi_status napi_get_value_external(napi_env env, napi_value value, void** result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -1943,11 +4076,14 @@ napi_status napi_create_reference(napi_env env,
                                   napi_value value,
                                   uint32_t initial_refcount,
                                   napi_ref* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
 
-  *result = new napi_ref__ { env, value, initial_refcount };
+  napi_ref ref{env->alloc_ref()};
+  ref->init(env, value, initial_refcount);
+  *result = ref;
 
   return napi_ok;
 }
@@ -1955,11 +4091,12 @@ napi_status napi_create_reference(napi_env env,
 // Deletes a reference. The referenced value is released, and may be GC'd
 // unless there are other references to it.
 napi_status napi_delete_reference(napi_env env, napi_ref ref) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, ref);
 
   ref->deinit(env);
-  delete ref;
+  env->free_ref(ref);
 
   return napi_ok;
 }
@@ -1969,6 +4106,7 @@ napi_status napi_delete_reference(napi_env env, napi_ref ref) {
 // is >0, and the referenced object is effectively "pinned". Calling this when
 // the refcount is 0 and the target is unavailable results in an error.
 napi_status napi_reference_ref(napi_env env, napi_ref ref, uint32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, ref);
 
@@ -1985,8 +4123,10 @@ napi_status napi_reference_ref(napi_env env, napi_ref ref, uint32_t* result) {
 // any time if there are no other references. Calling this when the refcount
 // is already 0 results in an error.
 napi_status napi_reference_unref(napi_env env, napi_ref ref, uint32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, ref);
+  RETURN_STATUS_IF_FALSE(env, ref->count() > 0, napi_generic_failure);
 
   ref->unref(env);
   if (result != nullptr) {
@@ -2002,6 +4142,7 @@ napi_status napi_reference_unref(napi_env env, napi_ref ref, uint32_t* result) {
 napi_status napi_get_reference_value(napi_env env,
                                      napi_ref ref,
                                      napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, ref);
   CHECK_ARG(env, result);
@@ -2013,6 +4154,7 @@ napi_status napi_get_reference_value(napi_env env,
 // Stub implementation of handle scope apis for JSC.
 napi_status napi_open_handle_scope(napi_env env,
                                    napi_handle_scope* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = reinterpret_cast<napi_handle_scope>(1);
@@ -2022,6 +4164,7 @@ napi_status napi_open_handle_scope(napi_env env,
 // Stub implementation of handle scope apis for JSC.
 napi_status napi_close_handle_scope(napi_env env,
                                     napi_handle_scope scope) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, scope);
   return napi_ok;
@@ -2030,6 +4173,7 @@ napi_status napi_close_handle_scope(napi_env env,
 // Stub implementation of handle scope apis for JSC.
 napi_status napi_open_escapable_handle_scope(napi_env env,
                                              napi_escapable_handle_scope* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = reinterpret_cast<napi_escapable_handle_scope>(1);
@@ -2039,6 +4183,7 @@ napi_status napi_open_escapable_handle_scope(napi_env env,
 // Stub implementation of handle scope apis for JSC.
 napi_status napi_close_escapable_handle_scope(napi_env env,
                                               napi_escapable_handle_scope scope) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, scope);
   return napi_ok;
@@ -2050,6 +4195,7 @@ napi_status napi_escape_handle(napi_env env,
                                napi_escapable_handle_scope scope,
                                napi_value escapee,
                                napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, scope);
   CHECK_ARG(env, escapee);
@@ -2063,6 +4209,7 @@ napi_status napi_new_instance(napi_env env,
                               size_t argc,
                               const napi_value* argv,
                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, constructor);
   if (argc > 0) {
@@ -2086,6 +4233,7 @@ napi_status napi_instanceof(napi_env env,
                             napi_value object,
                             napi_value constructor,
                             bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, object);
   CHECK_ARG(env, result);
@@ -2102,6 +4250,7 @@ napi_status napi_instanceof(napi_env env,
 }
 
 napi_status napi_is_exception_pending(napi_env env, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -2111,6 +4260,7 @@ napi_status napi_is_exception_pending(napi_env env, bool* result) {
 
 napi_status napi_get_and_clear_last_exception(napi_env env,
                                               napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -2125,6 +4275,7 @@ napi_status napi_get_and_clear_last_exception(napi_env env,
 }
 
 napi_status napi_is_arraybuffer(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -2142,25 +4293,45 @@ napi_status napi_is_arraybuffer(napi_env env, napi_value value, bool* result) {
   return napi_ok;
 }
 
+// Like napi_create_arraybuffer, but leaves the contents uninitialized.
+static napi_status create_pooled_arraybuffer(napi_env env, size_t byte_length, void** data, napi_value* result) {
+  void* bytes{env->arraybuffers->allocate(byte_length)};
+  if (bytes == nullptr) {
+    return napi_set_last_error(env, napi_generic_failure);
+  }
+
+  // JSC owns bytes from here on, even if this throws, and returns them
+  // through the deallocator.
+  JSValueRef exception{};
+  JSObjectRef buffer{JSObjectMakeArrayBufferWithBytesNoCopy(
+    env->context,
+    bytes,
+    byte_length,
+    napi_env__::arraybuffer_pool::deallocate,
+    nullptr,
+    &exception)};
+  CHECK_JSC(env, exception);
+
+  *data = bytes;
+  *result = ToNapi(buffer);
+  return napi_ok;
+}
+
 napi_status napi_create_arraybuffer(napi_env env,
                                     size_t byte_length,
                                     void** data,
                                     napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
-  *data = malloc(byte_length);
-  JSValueRef exception{};
-  *result = ToNapi(JSObjectMakeArrayBufferWithBytesNoCopy(
-    env->context,
-    *data,
-    byte_length,
-    [](void* bytes, void* deallocatorContext) {
-      free(bytes);
-    },
-    nullptr,
-    &exception));
-  CHECK_JSC(env, exception);
+  void* bytes{};
+  CHECK_NAPI(create_pooled_arraybuffer(env, byte_length, &bytes, result));
+  // Pooled memory may be reused, and ArrayBuffers start out zeroed.
+  std::memset(bytes, 0, byte_length);
+  if (data != nullptr) {
+    *data = bytes;
+  }
 
   return napi_ok;
 }
@@ -2171,6 +4342,7 @@ napi_status napi_create_external_arraybuffer(napi_env env,
                                              napi_finalize finalize_cb,
                                              void* finalize_hint,
                                              napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -2182,6 +4354,7 @@ napi_status napi_get_arraybuffer_info(napi_env env,
                                       napi_value arraybuffer,
                                       void** data,
                                       size_t* byte_length) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, arraybuffer);
 
@@ -2201,6 +4374,7 @@ napi_status napi_get_arraybuffer_info(napi_env env,
 }
 
 napi_status napi_is_typedarray(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -2219,6 +4393,7 @@ napi_status napi_create_typedarray(napi_env env,
                                    napi_value arraybuffer,
                                    size_t byte_offset,
                                    napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, arraybuffer);
   CHECK_ARG(env, result);
@@ -2282,6 +4457,7 @@ napi_status napi_get_typedarray_info(napi_env env,
                                      void** data,
                                      napi_value* arraybuffer,
                                      size_t* byte_offset) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, typedarray);
 
@@ -2323,8 +4499,10 @@ napi_status napi_get_typedarray_info(napi_env env,
         break;
       case kJSTypedArrayTypeBigInt64Array:
         *type = napi_bigint64_array;
+        break;
       case kJSTypedArrayTypeBigUint64Array:
         *type = napi_biguint64_array;
+        break;
       default:
         return napi_set_last_error(env, napi_generic_failure);
     }
@@ -2362,13 +4540,13 @@ napi_status napi_create_dataview(napi_env env,
                                  napi_value arraybuffer,
                                  size_t byte_offset,
                                  napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, arraybuffer);
   CHECK_ARG(env, result);
 
-  napi_value global{}, dataview_ctor{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "DataView", &dataview_ctor));
+  napi_value dataview_ctor{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::DataView, &dataview_ctor));
 
   napi_value byte_offset_value{}, byte_length_value{};
   napi_create_double(env, static_cast<double>(byte_offset), &byte_offset_value);
@@ -2380,13 +4558,13 @@ napi_status napi_create_dataview(napi_env env,
 }
 
 napi_status napi_is_dataview(napi_env env, napi_value value, bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
 
-  napi_value global{}, dataview_ctor{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "DataView", &dataview_ctor));
+  napi_value dataview_ctor{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::DataView, &dataview_ctor));
   CHECK_NAPI(napi_instanceof(env, value, dataview_ctor, result));
 
   return napi_ok;
@@ -2398,6 +4576,7 @@ napi_status napi_get_dataview_info(napi_env env,
                                    void** data,
                                    napi_value* arraybuffer,
                                    size_t* byte_offset) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, dataview);
 
@@ -2431,6 +4610,7 @@ napi_status napi_get_dataview_info(napi_env env,
 }
 
 napi_status napi_get_version(napi_env env, uint32_t* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
   *result = NAPI_VERSION;
@@ -2440,88 +4620,76 @@ napi_status napi_get_version(napi_env env, uint32_t* result) {
 napi_status napi_create_promise(napi_env env,
                                 napi_deferred* deferred,
                                 napi_value* promise) {
-  // TODO: Use JSObjectMakeDeferredPromise
-
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, deferred);
   CHECK_ARG(env, promise);
 
-  napi_value global{}, promise_ctor{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Promise", &promise_ctor));
-
-  struct Wrapper {
-    napi_value resolve{};
-    napi_value reject{};
+  JSObjectRef resolve{}, reject{};
+  JSValueRef exception{};
+  JSObjectRef js_promise{JSObjectMakeDeferredPromise(env->context, &resolve, &reject, &exception)};
+  CHECK_JSC(env, exception);
 
-    static napi_value Callback(napi_env env, napi_callback_info cbinfo) {
-      Wrapper* wrapper = reinterpret_cast<Wrapper*>(cbinfo->data);
-      wrapper->resolve = cbinfo->argv[0];
-      wrapper->reject = cbinfo->argv[1];
-      return nullptr;
-    }
-  } wrapper;
+  JSValueProtect(env->context, resolve);
+  JSValueProtect(env->context, reject);
+  *deferred = new napi_deferred__{resolve, reject};
+  env->deferreds.insert(*deferred);
+  *promise = ToNapi(js_promise);
 
-  napi_value executor{};
-  CHECK_NAPI(napi_create_function(env, "executor", NAPI_AUTO_LENGTH, Wrapper::Callback, &wrapper, &executor));
-  CHECK_NAPI(napi_new_instance(env, promise_ctor, 1, &executor, promise));
+  return napi_ok;
+}
 
-  napi_value deferred_value{};
-  CHECK_NAPI(napi_create_object(env, &deferred_value));
-  CHECK_NAPI(napi_set_named_property(env, deferred_value, "resolve", wrapper.resolve));
-  CHECK_NAPI(napi_set_named_property(env, deferred_value, "reject", wrapper.reject));
+static napi_status conclude_deferred(napi_env env,
+                                     napi_deferred deferred,
+                                     napi_value result,
+                                     bool is_resolved) {
+  CHECK_ARG(env, deferred);
+  CHECK_ARG(env, result);
 
-  napi_ref deferred_ref{};
-  CHECK_NAPI(napi_create_reference(env, deferred_value, 1, &deferred_ref));
-  *deferred = reinterpret_cast<napi_deferred>(deferred_ref);
+  JSValueRef args[] = { ToJSValue(result) };
+  JSValueRef exception{};
+  JSObjectCallAsFunction(env->context,
+                         is_resolved ? deferred->resolve : deferred->reject,
+                         nullptr,
+                         1,
+                         args,
+                         &exception);
+
+  JSValueUnprotect(env->context, deferred->resolve);
+  JSValueUnprotect(env->context, deferred->reject);
+  env->deferreds.erase(deferred);
+  delete deferred;
 
+  CHECK_JSC(env, exception);
   return napi_ok;
 }
 
 napi_status napi_resolve_deferred(napi_env env,
                                   napi_deferred deferred,
                                   napi_value resolution) {
+  RECORD_CALL();
   CHECK_ENV(env);
-  CHECK_ARG(env, deferred);
-
-  napi_ref deferred_ref{reinterpret_cast<napi_ref>(deferred)};
-  napi_value undefined{}, deferred_value{}, resolve{};
-  CHECK_NAPI(napi_get_undefined(env, &undefined));
-  CHECK_NAPI(napi_get_reference_value(env, deferred_ref, &deferred_value));
-  CHECK_NAPI(napi_get_named_property(env, deferred_value, "resolve", &resolve));
-  CHECK_NAPI(napi_call_function(env, undefined, resolve, 1, &resolution, nullptr));
-  CHECK_NAPI(napi_delete_reference(env, deferred_ref));
-
-  return napi_ok;
+  return conclude_deferred(env, deferred, resolution, true);
 }
 
 napi_status napi_reject_deferred(napi_env env,
                                  napi_deferred deferred,
                                  napi_value rejection) {
+  RECORD_CALL();
   CHECK_ENV(env);
-  CHECK_ARG(env, deferred);
-
-  napi_ref deferred_ref{reinterpret_cast<napi_ref>(deferred)};
-  napi_value undefined{}, deferred_value{}, reject{};
-  CHECK_NAPI(napi_get_undefined(env, &undefined));
-  CHECK_NAPI(napi_get_reference_value(env, deferred_ref, &deferred_value));
-  CHECK_NAPI(napi_get_named_property(env, deferred_value, "reject", &reject));
-  CHECK_NAPI(napi_call_function(env, undefined, reject, 1, &rejection, nullptr));
-  CHECK_NAPI(napi_delete_reference(env, deferred_ref));
-
-  return napi_ok;
+  return conclude_deferred(env, deferred, rejection, false);
 }
 
 napi_status napi_is_promise(napi_env env,
                             napi_value promise,
                             bool* is_promise) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, promise);
   CHECK_ARG(env, is_promise);
 
-  napi_value global{}, promise_ctor{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Promise", &promise_ctor));
+  napi_value promise_ctor{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::Promise, &promise_ctor));
   CHECK_NAPI(napi_instanceof(env, promise, promise_ctor, is_promise));
 
   return napi_ok;
@@ -2530,31 +4698,118 @@ napi_status napi_is_promise(napi_env env,
 napi_status napi_run_script(napi_env env,
                             napi_value script,
                             napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, script);
   CHECK_ARG(env, result);
+  RETURN_STATUS_IF_FALSE(env, JSValueIsString(env->context, ToJSValue(script)), napi_string_expected);
 
   JSValueRef exception{};
 
   JSString script_str{ToJSString(env, script, &exception)};
   CHECK_JSC(env, exception);
 
-  *result = ToNapi(JSEvaluateScript(
-    env->context, script_str, nullptr, nullptr, 0, &exception));
+  JSScriptRef compiled{env->scripts.find(script_str)};
+  if (compiled != nullptr) {
+    *result = ToNapi(JSScriptEvaluate(env->context, compiled, nullptr, &exception));
+  } else {
+    // Scripts are named after their hash so that profilers and stack traces
+    // can tell them apart.
+    size_t hash{std::hash<std::u16string_view>{}(std::u16string_view{
+      reinterpret_cast<const char16_t*>(JSStringGetCharactersPtr(script_str)), JSStringGetLength(script_str)})};
+    char url_buf[48];
+    std::snprintf(url_buf, sizeof(url_buf), "napi-script-%016zx.js", hash);
+    JSString url{url_buf};
+
+    compiled = env->scripts.insert(env->context, script_str, url);
+    if (compiled != nullptr) {
+      *result = ToNapi(JSScriptEvaluate(env->context, compiled, nullptr, &exception));
+    } else {
+      // Throws the engine's own SyntaxError.
+      *result = ToNapi(JSEvaluateScript(env->context, script_str, nullptr, url, 1, &exception));
+    }
+  }
   CHECK_JSC(env, exception);
 
   return napi_ok;
 }
 
+bool napi_jsc_claim_instance_data_slot(uint32_t* slot) {
+  // Slot 0 belongs to napi_set_instance_data.
+  static std::atomic<uint32_t> next_slot{1};
+  uint32_t claimed{next_slot.fetch_add(1, std::memory_order_relaxed)};
+  if (claimed >= NAPI_JSC_INSTANCE_DATA_SLOTS) {
+    return false;
+  }
+  *slot = claimed;
+  return true;
+}
+
+bool napi_env_jsc_set_instance_data_slot(napi_env env,
+                                         uint32_t slot,
+                                         void* data,
+                                         napi_jsc_finalize finalize_cb,
+                                         void* finalize_hint) {
+  if (env == nullptr || slot == 0 || slot >= NAPI_JSC_INSTANCE_DATA_SLOTS) {
+    return false;
+  }
+  env->instance_data_slots[slot] = {data, finalize_cb, finalize_hint};
+  return true;
+}
+
+void* napi_env_jsc_get_instance_data_slot(napi_env env, uint32_t slot) {
+  if (env == nullptr || slot == 0 || slot >= NAPI_JSC_INSTANCE_DATA_SLOTS) {
+    return nullptr;
+  }
+  return env->instance_data_slots[slot].data;
+}
+
+void napi_env_jsc_get_script_cache_stats(napi_env env, napi_jsc_script_cache_stats* result) {
+  result->hits = env->scripts.hits;
+  result->misses = env->scripts.misses;
+  result->count = env->scripts.entries.size();
+}
+
+void napi_env_jsc_get_property_key_stats(napi_env env, napi_jsc_property_key_stats* result) {
+  result->pointer_hits = env->property_keys.pointer_hits;
+  result->name_hits = env->property_keys.name_hits;
+  result->misses = env->property_keys.misses;
+  result->count = env->property_keys.entries.size();
+}
+
+size_t napi_jsc_get_call_stats(napi_jsc_call_stats* entries, size_t capacity) {
+#if NAPI_JSC_STATS
+  return CallStats::Snapshot(entries, capacity);
+#else
+  return 0;
+#endif
+}
+
+void napi_env_jsc_get_memory_stats(napi_env env, napi_jsc_env_memory_stats* result) {
+  result->creation_ns = env->creation_ns;
+  result->external_memory = env->external_memory.load(std::memory_order_relaxed);
+  result->ref_table_bytes = env->ref_chunks.size() * napi_env__::ref_chunk_size * sizeof(napi_ref__);
+  result->strong_refs = env->strong_ref_count;
+  std::lock_guard lock(env->arraybuffers->mutex);
+  result->arraybuffer_pool_bytes = env->arraybuffers->bytes_cached;
+}
+
+void napi_env_jsc_get_arraybuffer_pool_stats(napi_env env, napi_jsc_arraybuffer_pool_stats* result) {
+  napi_env__::arraybuffer_pool& pool{*env->arraybuffers};
+  std::lock_guard lock(pool.mutex);
+  result->hits = pool.hits;
+  result->misses = pool.misses;
+  result->bytes_cached = pool.bytes_cached;
+}
+
 napi_status napi_adjust_external_memory(napi_env env,
                                         int64_t change_in_bytes,
                                         int64_t* adjusted_value) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, adjusted_value);
 
-  // TODO: Determine if JSC needs or is able to do anything here
-  // For now, we can lie and say that we always adjusted more memory
-  *adjusted_value = change_in_bytes;
+  *adjusted_value = env->adjust_external_memory(change_in_bytes);
 
   return napi_ok;
 }
@@ -2564,6 +4819,7 @@ napi_status napi_adjust_external_memory(napi_env env,
 napi_status napi_create_date(napi_env env,
                              double time,
                              napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, result);
 
@@ -2579,6 +4835,7 @@ napi_status napi_create_date(napi_env env,
 napi_status napi_is_date(napi_env env,
                          napi_value value,
                          bool* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -2591,6 +4848,7 @@ napi_status napi_is_date(napi_env env,
 napi_status napi_get_date_value(napi_env env,
                                 napi_value value,
                                 double* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, value);
   CHECK_ARG(env, result);
@@ -2612,11 +4870,16 @@ napi_status napi_add_finalizer(napi_env env,
                                napi_finalize finalize_cb,
                                void* finalize_hint,
                                napi_ref* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, js_object);
-  add_finalizer(env, js_object, [=]{
-    finalize_cb(env, native_object, finalize_hint);
-  });
+  CHECK_ARG(env, finalize_cb);
+  RETURN_STATUS_IF_FALSE(env, JSValueIsObject(env->context, ToJSValue(js_object)), napi_object_expected);
+
+  WrapperInfo* info{};
+  CHECK_NAPI(WrapperInfo::Wrap(env, js_object, &info));
+  info->AddFinalizer(finalize_cb, native_object, finalize_hint);
+
   if (result) {
     napi_ref res;
     CHECK_NAPI(napi_create_reference(env, js_object, 0, &res));
@@ -2634,93 +4897,112 @@ napi_status napi_get_all_property_names(napi_env env,
                                         napi_key_filter key_filter,
                                         napi_key_conversion key_conversion,
                                         napi_value* result) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, object);
   CHECK_ARG(env, result);
+  RETURN_STATUS_IF_FALSE(env, JSValueIsObject(env->context, ToJSValue(object)), napi_object_expected);
 
-  napi_value array{}, push{}, global{}, object_ctor{};
-  CHECK_NAPI(napi_create_array(env, &array));
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-  CHECK_NAPI(napi_get_named_property(env, array, "push", &push));
+  JSValueRef exception{};
 
-  std::vector<napi_value> getter_methods;
-  if (!(key_filter & napi_key_skip_strings)) {
-    napi_value method{};
-    CHECK_NAPI(napi_get_named_property(env, object_ctor, "getOwnPropertyNames", &method));
-    getter_methods.push_back(method);
-  }
-  if (!(key_filter & napi_key_skip_symbols)) {
-    napi_value method{};
-    CHECK_NAPI(napi_get_named_property(env, object_ctor, "getOwnPropertySymbols", &method));
-    getter_methods.push_back(method);
-  }
+  // for-in semantics, which is also what napi_get_property_names asks for,
+  // is what JSObjectCopyPropertyNames returns, except that it doesn't let a
+  // non-enumerable own key hide an enumerable inherited one. So it's only
+  // used when nothing is inherited, which is the common case.
+  if (key_mode == napi_key_include_prototypes &&
+      key_filter == (napi_key_enumerable | napi_key_skip_symbols) &&
+      key_conversion == napi_key_numbers_to_strings) {
+    JSValueRef prototype{JSObjectGetPrototype(env->context, ToJSObject(env, object))};
+    bool inherits{};
+    if (JSValueIsObject(env->context, prototype)) {
+      JSPropertyNameArrayRef inherited{JSObjectCopyPropertyNames(env->context, ToJSObject(env, ToNapi(prototype)))};
+      inherits = JSPropertyNameArrayGetCount(inherited) != 0;
+      JSPropertyNameArrayRelease(inherited);
+    }
 
-  napi_value current = object;
-  while (true) {
-    for (napi_value method : getter_methods) {
-      napi_value properties{};
-      // Object.getOwnProperty[Names|Symbols](current)
-      CHECK_NAPI(napi_call_function(env, object_ctor, method, 1, &current, &properties));
-      uint32_t length = 0;
-      CHECK_NAPI(napi_get_array_length(env, properties, &length));
-      for (uint32_t i = 0; i != length; ++i) {
-        napi_value key{};
-        CHECK_NAPI(napi_get_element(env, properties, i, &key));
-        // TODO: coerce to number if napi_key_keep_numbers
-        // TODO: filter writable/enumerable/configurable
-#if 0
-        napi_value descriptor{};
-        std::array<napi_value, 2> args { current, key };
-        // Object.getOwnPropertyDescriptor(current, key)
-        CHECK_NAPI(napi_call_function(env, object_ctor, getOwnPropertyDescriptor, 2, args.data(), &descriptor));
-#endif
-        CHECK_NAPI(napi_call_function(env, array, push, 1, &key, NULL));
+    if (!inherits) {
+      JSPropertyNameArrayRef names{JSObjectCopyPropertyNames(env->context, ToJSObject(env, object))};
+      size_t count{JSPropertyNameArrayGetCount(names)};
+
+      // The GC only finds keys that aren't in the array yet by scanning the
+      // stack, so keys that don't fit there are protected until they are.
+      ScratchBuffer<JSValueRef, 1024> keys{count};
+      for (size_t i = 0; i != count; ++i) {
+        keys.data()[i] = JSValueMakeString(env->context, JSPropertyNameArrayGetNameAtIndex(names, i));
+        if (!keys.OnStack()) {
+          JSValueProtect(env->context, keys.data()[i]);
+        }
       }
+      JSPropertyNameArrayRelease(names);
+      JSObjectRef array{JSObjectMakeArray(env->context, count, keys.data(), &exception)};
+      if (!keys.OnStack()) {
+        for (size_t i = 0; i != count; ++i) {
+          JSValueUnprotect(env->context, keys.data()[i]);
+        }
+      }
+      CHECK_JSC(env, exception);
+
+      *result = ToNapi(array);
+      return napi_ok;
     }
-    if (key_mode == napi_key_own_only) break;
-    napi_value next{};
-    CHECK_NAPI(napi_get_prototype(env, current, &next));
-    napi_valuetype next_type;
-    CHECK_NAPI(napi_typeof(env, next, &next_type));
-    if (next_type == napi_null) break;
-    current = next;
-  };
+  }
+
+  JSObjectRef helper{};
+  CHECK_NAPI(GetHelper(env, Helper::PropertyNames, &helper));
 
-  *result = array;
+  JSValueRef args[]{
+    ToJSValue(object),
+    JSValueMakeBoolean(env->context, key_mode == napi_key_own_only),
+    JSValueMakeNumber(env->context, key_filter),
+    JSValueMakeBoolean(env->context, key_conversion == napi_key_keep_numbers),
+  };
+  *result = ToNapi(JSObjectCallAsFunction(env->context, helper, nullptr, std::size(args), args, &exception));
+  CHECK_JSC(env, exception);
 
   return napi_ok;
 }
 
-static napi_status create_bigint_string(napi_env env,
-                                        std::string string,
-                                        napi_value* result) {
-  CHECK_ENV(env);
-  CHECK_ARG(env, result);
+static bool is_bigint(napi_env env, napi_value value) {
+  // Older versions of JSC report BigInts as objects. See napi_typeof.
+  JSType type{JSValueGetType(env->context, ToJSValue(value))};
+  return type > kJSTypeString && type != kJSTypeSymbol && !JSValueIsObject(env->context, ToJSValue(value));
+}
 
-  napi_value global{}, bigint_ctor{}, js_string{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "BigInt", &bigint_ctor));
-  CHECK_NAPI(napi_create_string_utf8(env, string.data(), string.size(), &js_string));
-  CHECK_NAPI(napi_new_instance(env, bigint_ctor, 1, &js_string, result));
+// Converts through a single-element BigInt64Array or BigUint64Array when the
+// BigInt C API isn't available: the element is written natively and read
+// back as a BigInt, or the other way around.
+template <typename T>
+static napi_status create_bigint_scratch(napi_env env, T value, napi_value* result) {
+  JSObjectRef scratch{};
+  CHECK_NAPI(GetHelper(env, std::is_signed_v<T> ? Helper::BigInt64Scratch : Helper::BigUint64Scratch, &scratch));
 
+  JSValueRef exception{};
+  T* bytes{static_cast<T*>(JSObjectGetTypedArrayBytesPtr(env->context, scratch, &exception))};
+  CHECK_JSC(env, exception);
+  *bytes = value;
+
+  *result = ToNapi(JSObjectGetPropertyAtIndex(env->context, scratch, 0, &exception));
+  CHECK_JSC(env, exception);
   return napi_ok;
 }
 
-static napi_status bigint_to_string(napi_env env, napi_value value, std::string &string) {
-  CHECK_ENV(env);
-  CHECK_ARG(env, value);
+template <typename T>
+static napi_status get_bigint_scratch(napi_env env, napi_value value, T* result, bool* lossless) {
+  JSObjectRef scratch{};
+  CHECK_NAPI(GetHelper(env, std::is_signed_v<T> ? Helper::BigInt64Scratch : Helper::BigUint64Scratch, &scratch));
 
+  // Typed array stores wrap BigInts to 64 bits, so the conversion was
+  // lossless iff the stored element is still equal to the original.
   JSValueRef exception{};
-  JSString js_string{ToJSString(env, value, &exception)};
+  JSObjectSetPropertyAtIndex(env->context, scratch, 0, ToJSValue(value), &exception);
+  CHECK_JSC(env, exception);
+  JSValueRef stored{JSObjectGetPropertyAtIndex(env->context, scratch, 0, &exception)};
+  CHECK_JSC(env, exception);
+  T* bytes{static_cast<T*>(JSObjectGetTypedArrayBytesPtr(env->context, scratch, &exception))};
   CHECK_JSC(env, exception);
 
-  #pragma clang diagnostic push
-  #pragma clang diagnostic ignored "-Wvla"
-  char buf[js_string.LengthUTF8()];
-  #pragma clang diagnostic pop
-  js_string.CopyToUTF8(buf, sizeof(buf), nullptr);
-  string = std::string { buf };
+  *result = *bytes;
+  *lossless = JSValueIsStrictEqual(env->context, stored, ToJSValue(value));
   return napi_ok;
 }
 
@@ -2728,42 +5010,111 @@ static napi_status bigint_to_string(napi_env env, napi_value value, std::string
 napi_status napi_create_bigint_int64(napi_env env,
                                      int64_t value,
                                      napi_value* result) {
-  return create_bigint_string(env, std::to_string(value), result);
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+
+#if NAPI_JSC_BIGINT_API
+  if (__builtin_available(macOS 15.0, iOS 18.0, *)) {
+    JSValueRef exception{};
+    *result = ToNapi(JSBigIntCreateWithInt64(env->context, value, &exception));
+    CHECK_JSC(env, exception);
+    return napi_ok;
+  }
+#endif
+  return create_bigint_scratch(env, value, result);
 }
 
 napi_status napi_create_bigint_uint64(napi_env env, uint64_t value, napi_value* result) {
-  return create_bigint_string(env, std::to_string(value), result);
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+
+#if NAPI_JSC_BIGINT_API
+  if (__builtin_available(macOS 15.0, iOS 18.0, *)) {
+    JSValueRef exception{};
+    *result = ToNapi(JSBigIntCreateWithUInt64(env->context, value, &exception));
+    CHECK_JSC(env, exception);
+    return napi_ok;
+  }
+#endif
+  return create_bigint_scratch(env, value, result);
 }
 
 napi_status napi_get_value_bigint_int64(napi_env env,
                                         napi_value value,
                                         int64_t* result,
                                         bool* lossless) {
-  std::string string;
-  CHECK_NAPI(bigint_to_string(env, value, string));
-  errno = 0;
-  auto ret = std::strtoll(string.data(), nullptr, 10);
-  *lossless = errno != ERANGE;
-  *result = ret;
-  return napi_ok;
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+  CHECK_ARG(env, result);
+  CHECK_ARG(env, lossless);
+  RETURN_STATUS_IF_FALSE(env, is_bigint(env, value), napi_bigint_expected);
+
+#if NAPI_JSC_BIGINT_API
+  if (__builtin_available(macOS 15.0, iOS 18.0, *)) {
+    JSValueRef exception{};
+    *result = JSValueToInt64(env->context, ToJSValue(value), &exception);
+    CHECK_JSC(env, exception);
+    *lossless = JSValueCompareInt64(env->context, ToJSValue(value), *result, &exception) == kJSRelationConditionEqual;
+    CHECK_JSC(env, exception);
+    return napi_ok;
+  }
+#endif
+  return get_bigint_scratch(env, value, result, lossless);
 }
 
 napi_status napi_get_value_bigint_uint64(napi_env env, napi_value value, uint64_t* result, bool* lossless) {
-  std::string string;
-  CHECK_NAPI(bigint_to_string(env, value, string));
-  errno = 0;
-  auto ret = std::strtoull(string.data(), nullptr, 10);
-  *lossless = errno != ERANGE;
-  *result = ret;
-  return napi_ok;
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+  CHECK_ARG(env, result);
+  CHECK_ARG(env, lossless);
+  RETURN_STATUS_IF_FALSE(env, is_bigint(env, value), napi_bigint_expected);
+
+#if NAPI_JSC_BIGINT_API
+  if (__builtin_available(macOS 15.0, iOS 18.0, *)) {
+    JSValueRef exception{};
+    *result = JSValueToUInt64(env->context, ToJSValue(value), &exception);
+    CHECK_JSC(env, exception);
+    *lossless = JSValueCompareUInt64(env->context, ToJSValue(value), *result, &exception) == kJSRelationConditionEqual;
+    CHECK_JSC(env, exception);
+    return napi_ok;
+  }
+#endif
+  return get_bigint_scratch(env, value, result, lossless);
 }
 
+// JSC has no API for BigInt words, so these go through a BigUint64Array and
+// a small helper doing the shifting on the JS side.
 napi_status napi_create_bigint_words(napi_env env,
                                      int sign_bit,
                                      size_t word_count,
                                      const uint64_t* words,
                                      napi_value* result) {
-  throw std::runtime_error("TODO");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  RETURN_STATUS_IF_FALSE(env, words != nullptr || word_count == 0, napi_invalid_arg);
+  RETURN_STATUS_IF_FALSE(env, word_count <= INT_MAX, napi_invalid_arg);
+
+  JSObjectRef helper{};
+  CHECK_NAPI(GetHelper(env, Helper::BigIntFromWords, &helper));
+
+  JSValueRef exception{};
+  JSObjectRef array{JSObjectMakeTypedArray(env->context, kJSTypedArrayTypeBigUint64Array, word_count, &exception)};
+  CHECK_JSC(env, exception);
+  if (word_count != 0) {
+    void* bytes{JSObjectGetTypedArrayBytesPtr(env->context, array, &exception)};
+    CHECK_JSC(env, exception);
+    std::memcpy(bytes, words, word_count * sizeof(uint64_t));
+  }
+
+  JSValueRef args[]{array, JSValueMakeBoolean(env->context, sign_bit != 0)};
+  *result = ToNapi(JSObjectCallAsFunction(env->context, helper, nullptr, std::size(args), args, &exception));
+  CHECK_JSC(env, exception);
+  return napi_ok;
 }
 
 napi_status napi_get_value_bigint_words(napi_env env,
@@ -2771,37 +5122,141 @@ napi_status napi_get_value_bigint_words(napi_env env,
                                         int* sign_bit,
                                         size_t* word_count,
                                         uint64_t* words) {
-  throw std::runtime_error("TODO");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+  CHECK_ARG(env, word_count);
+  RETURN_STATUS_IF_FALSE(env, is_bigint(env, value), napi_bigint_expected);
+
+  JSObjectRef helper{};
+  CHECK_NAPI(GetHelper(env, Helper::BigIntToWords, &helper));
+
+  size_t capacity{words != nullptr ? *word_count : 0};
+  JSValueRef exception{};
+  JSObjectRef array{JSObjectMakeTypedArray(env->context, kJSTypedArrayTypeBigUint64Array, capacity, &exception)};
+  CHECK_JSC(env, exception);
+
+  JSValueRef args[]{ToJSValue(value), array};
+  JSValueRef count_value{JSObjectCallAsFunction(env->context, helper, nullptr, std::size(args), args, &exception)};
+  CHECK_JSC(env, exception);
+  int32_t count{JSValueToInt32(env->context, count_value, &exception)};
+  CHECK_JSC(env, exception);
+
+  bool negative{count < 0};
+  size_t needed{static_cast<size_t>(negative ? ~count : count)};
+  if (words != nullptr) {
+    size_t copied{std::min(needed, capacity)};
+    if (copied != 0) {
+      void* bytes{JSObjectGetTypedArrayBytesPtr(env->context, array, &exception)};
+      CHECK_JSC(env, exception);
+      std::memcpy(words, bytes, copied * sizeof(uint64_t));
+    }
+    if (sign_bit != nullptr) {
+      *sign_bit = negative;
+    }
+  }
+  *word_count = needed;
+  return napi_ok;
+}
+
+// Instance data
+// Like Node, replacing instance data doesn't finalize the old data.
+napi_status napi_set_instance_data(napi_env env,
+                                   void* data,
+                                   napi_finalize finalize_cb,
+                                   void* finalize_hint) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  env->instance_data_slots[0] = {data, finalize_cb, finalize_hint};
+  return napi_ok;
+}
+
+napi_status napi_get_instance_data(napi_env env, void** data) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, data);
+  *data = env->instance_data_slots[0].data;
+  return napi_ok;
 }
 
 // MARK: - NAPI 7: Detatchable ArrayBuffer
 
+// Detaching releases the buffer's contents immediately, running the
+// deallocator of an external buffer exactly once.
+//
+// JSC pins a buffer for good once its bytes are handed out through the C
+// API, and a pinned buffer can't be detached. So once napi_get_arraybuffer_info,
+// napi_get_typedarray_info, napi_get_dataview_info or napi_get_buffer_info
+// has returned a buffer's data, detaching it fails with
+// napi_detachable_arraybuffer_expected.
 napi_status napi_detach_arraybuffer(napi_env env, napi_value arraybuffer) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, arraybuffer);
+
+  bool is_arraybuffer{};
+  CHECK_NAPI(napi_is_arraybuffer(env, arraybuffer, &is_arraybuffer));
+  RETURN_STATUS_IF_FALSE(env, is_arraybuffer, napi_arraybuffer_expected);
+
+  JSObjectRef detach{};
+  CHECK_NAPI(GetHelper(env, Helper::DetachArrayBuffer, &detach));
+  JSValueRef args[]{ToJSValue(arraybuffer)};
+  JSValueRef exception{};
+  JSValueRef detached{JSObjectCallAsFunction(env->context, detach, nullptr, std::size(args), args, &exception)};
+  CHECK_JSC(env, exception);
+  RETURN_STATUS_IF_FALSE(env, JSValueToBoolean(env->context, detached), napi_detachable_arraybuffer_expected);
+
+  return napi_ok;
 }
 
 napi_status napi_is_detached_arraybuffer(napi_env env, napi_value value, bool* result) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+  CHECK_ARG(env, result);
+
+  bool is_arraybuffer{};
+  CHECK_NAPI(napi_is_arraybuffer(env, value, &is_arraybuffer));
+  if (!is_arraybuffer) {
+    *result = false;
+    return napi_ok;
+  }
+
+  JSObjectRef is_detached{};
+  CHECK_NAPI(GetHelper(env, Helper::IsDetachedArrayBuffer, &is_detached));
+  JSValueRef args[]{ToJSValue(value)};
+  JSValueRef exception{};
+  JSValueRef detached{JSObjectCallAsFunction(env->context, is_detached, nullptr, std::size(args), args, &exception)};
+  CHECK_JSC(env, exception);
+  *result = JSValueToBoolean(env->context, detached);
+
+  return napi_ok;
 }
 
 // MARK: - NAPI 8
 
 napi_status napi_object_freeze(napi_env env,
                                napi_value object) {
-  napi_value global{}, object_ctor{}, freeze{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-  CHECK_NAPI(napi_get_named_property(env, object_ctor, "freeze", &freeze));
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, object);
+
+  napi_value object_ctor{}, freeze{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::Object, &object_ctor));
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::ObjectFreeze, &freeze));
   CHECK_NAPI(napi_call_function(env, object_ctor, freeze, 1, &object, nullptr));
   return napi_ok;
 }
 
 napi_status napi_object_seal(napi_env env,
                              napi_value object) {
-  napi_value global{}, object_ctor{}, seal{};
-  CHECK_NAPI(napi_get_global(env, &global));
-  CHECK_NAPI(napi_get_named_property(env, global, "Object", &object_ctor));
-  CHECK_NAPI(napi_get_named_property(env, object_ctor, "seal", &seal));
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, object);
+
+  napi_value object_ctor{}, seal{};
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::Object, &object_ctor));
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::ObjectSeal, &seal));
   CHECK_NAPI(napi_call_function(env, object_ctor, seal, 1, &object, nullptr));
   return napi_ok;
 }
@@ -2809,16 +5264,16 @@ napi_status napi_object_seal(napi_env env,
 napi_status napi_type_tag_object(napi_env env,
                                  napi_value value,
                                  const napi_type_tag* type_tag) {
+  RECORD_CALL();
   bool newly_created = false;
   napi_value tag_map;
   if (env->tag_map) {
     tag_map = ToNapi(env->tag_map);
   } else {
     newly_created = true;
-    napi_value global{}, map_ctor{};
-    CHECK_NAPI(napi_get_global(env, &global));
+    napi_value map_ctor{};
     // need to use a WeakMap, otherwise tagging an object retains it forever
-    CHECK_NAPI(napi_get_named_property(env, global, "WeakMap", &map_ctor));
+    CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMap, &map_ctor));
     CHECK_NAPI(napi_new_instance(env, map_ctor, 0, nullptr, &tag_map));
     JSValueRef tag_map_jsc = ToJSValue(tag_map);
     JSValueProtect(env->context, tag_map_jsc);
@@ -2827,7 +5282,7 @@ napi_status napi_type_tag_object(napi_env env,
 
   if (!newly_created) {
     napi_value map_has{}, has_result{};
-    CHECK_NAPI(napi_get_named_property(env, tag_map, "has", &map_has));
+    CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMapPrototypeHas, &map_has));
     CHECK_NAPI(napi_call_function(env, tag_map, map_has, 1, &value, &has_result));
     bool has_bool = true;
     CHECK_NAPI(napi_get_value_bool(env, has_result, &has_bool));
@@ -2835,7 +5290,7 @@ napi_status napi_type_tag_object(napi_env env,
   }
 
   napi_value map_set{};
-  CHECK_NAPI(napi_get_named_property(env, tag_map, "set", &map_set));
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMapPrototypeSet, &map_set));
 
   napi_value arraybuf;
   void *data;
@@ -2851,6 +5306,7 @@ napi_status napi_check_object_type_tag(napi_env env,
                                        napi_value value,
                                        const napi_type_tag* type_tag,
                                        bool* result) {
+  RECORD_CALL();
   JSValueRef map = env->tag_map;
   if (!map) {
     *result = false;
@@ -2859,7 +5315,7 @@ napi_status napi_check_object_type_tag(napi_env env,
 
   napi_value tag_map = ToNapi(map);
   napi_value map_get{}, get_result{};
-  CHECK_NAPI(napi_get_named_property(env, tag_map, "get", &map_get));
+  CHECK_NAPI(GetIntrinsic(env, Intrinsic::WeakMapPrototypeGet, &map_get));
   CHECK_NAPI(napi_call_function(env, tag_map, map_get, 1, &value, &get_result));
 
   bool is_arraybuf = false;
@@ -2891,11 +5347,211 @@ void napi_fatal_error(const char* location,
 
 napi_status napi_fatal_exception(napi_env env,
                                  napi_value err) {
+  RECORD_CALL();
   // TODO: this should directly trigger 'uncaughtException'
   // ...but there isn't much we can do since there's no `process` in JSC
   return napi_throw(env, err);
 }
 
+// MARK: - Node+AsyncWork
+
+struct napi_async_work__ {
+  napi_env env;
+  napi_async_execute_callback execute;
+  napi_async_complete_callback complete;
+  void* data;
+  // The worker deque the work was queued on. See WorkerPool::Cancel.
+  size_t worker;
+  bool queued;
+  bool cancelled;
+};
+
+namespace {
+  // Runs async work for every env in the process, with one thread per core.
+  // Each thread has its own deque: work is spread across them round robin and
+  // idle threads steal from the others, so there's no single queue for all
+  // the threads to contend on.
+  class WorkerPool {
+   public:
+    static WorkerPool& Shared() {
+      // Never destroyed, since its threads run for the life of the process.
+      static WorkerPool* pool{new WorkerPool(std::max(1u, std::thread::hardware_concurrency()))};
+      return *pool;
+    }
+
+    size_t Size() const {
+      return _workers.size();
+    }
+
+    void Submit(napi_async_work work) {
+      size_t index{_next.fetch_add(1, std::memory_order_relaxed) % _workers.size()};
+      work->worker = index;
+      // Pushed before it's counted, so a thread that wakes up for it is
+      // sure to find a job.
+      {
+        std::lock_guard lock(_workers[index]->mutex);
+        _workers[index]->jobs.push_back(work);
+      }
+      {
+        std::lock_guard lock(_sleep_mutex);
+        ++_pending;
+      }
+      _wake.notify_one();
+    }
+
+    // Returns false if a thread has already taken the work, or is about to.
+    bool Cancel(napi_async_work work) {
+      std::lock_guard sleep_lock(_sleep_mutex);
+      // Every job left in the deques has been claimed by a woken thread.
+      if (_pending == 0) {
+        return false;
+      }
+      Worker& worker{*_workers[work->worker]};
+      std::lock_guard lock(worker.mutex);
+      auto it{std::find(worker.jobs.begin(), worker.jobs.end(), work)};
+      if (it == worker.jobs.end()) {
+        return false;
+      }
+      worker.jobs.erase(it);
+      --_pending;
+      return true;
+    }
+
+    // Completions from jobs that finish together share a hop to the JS
+    // thread.
+    static void Complete(void* data) {
+      napi_async_work work{static_cast<napi_async_work>(data)};
+      napi_env env{work->env};
+      napi_status status{work->cancelled ? napi_cancelled : napi_ok};
+      work->queued = false;
+      work->cancelled = false;
+      --env->active_async_work;
+      // May delete the work.
+      if (work->complete != nullptr) {
+        work->complete(env, status, work->data);
+      }
+      env->check_empty();
+    }
+
+   private:
+    struct Worker {
+      std::mutex mutex;
+      std::deque<napi_async_work> jobs;
+    };
+
+    explicit WorkerPool(size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        _workers.emplace_back(new Worker);
+      }
+      for (size_t i = 0; i < count; ++i) {
+        std::thread(&WorkerPool::Run, this, i).detach();
+      }
+    }
+
+    // Takes from the front of the thread's own deque, or else from the back
+    // of another's.
+    napi_async_work Take(size_t index) {
+      for (size_t i = 0; i < _workers.size(); ++i) {
+        Worker& worker{*_workers[(index + i) % _workers.size()]};
+        std::lock_guard lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+          napi_async_work work{};
+          if (i == 0) {
+            work = worker.jobs.front();
+            worker.jobs.pop_front();
+          } else {
+            work = worker.jobs.back();
+            worker.jobs.pop_back();
+          }
+          return work;
+        }
+      }
+      return nullptr;
+    }
+
+    void Run(size_t index) {
+      while (true) {
+        {
+          std::unique_lock lock(_sleep_mutex);
+          _wake.wait(lock, [this] { return _pending != 0; });
+          // Claims one of the jobs in the deques, so Take can't come back
+          // empty-handed.
+          --_pending;
+        }
+        napi_async_work work{Take(index)};
+        assert(work != nullptr);
+        work->execute(work->env, work->data);
+        work->env->enqueue_completion(Complete, work);
+      }
+    }
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<size_t> _next{0};
+    // Jobs in the deques that no thread has claimed yet, which idle threads
+    // sleep on. Guarded by _sleep_mutex. Never more than the number of jobs
+    // in the deques.
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    size_t _pending{0};
+  };
+}
+
+size_t napi_jsc_async_work_threads() {
+  return WorkerPool::Shared().Size();
+}
+
+napi_status napi_create_async_work(napi_env env,
+                                   napi_value async_resource,
+                                   napi_value async_resource_name,
+                                   napi_async_execute_callback execute,
+                                   napi_async_complete_callback complete,
+                                   void* data,
+                                   napi_async_work* result) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, execute);
+  CHECK_ARG(env, result);
+
+  *result = new napi_async_work__{env, execute, complete, data};
+  return napi_ok;
+}
+
+napi_status napi_delete_async_work(napi_env env, napi_async_work work) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, work);
+  RETURN_STATUS_IF_FALSE(env, !work->queued, napi_generic_failure);
+
+  delete work;
+  return napi_ok;
+}
+
+napi_status napi_queue_async_work(napi_env env, napi_async_work work) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, work);
+  RETURN_STATUS_IF_FALSE(env, !work->queued, napi_generic_failure);
+
+  work->queued = true;
+  ++env->active_async_work;
+  WorkerPool::Shared().Submit(work);
+  return napi_ok;
+}
+
+// Like Node, only work that hasn't started can be cancelled. Its complete
+// callback is then called with napi_cancelled.
+napi_status napi_cancel_async_work(napi_env env, napi_async_work work) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, work);
+  RETURN_STATUS_IF_FALSE(env, work->queued && !work->cancelled, napi_generic_failure);
+  RETURN_STATUS_IF_FALSE(env, WorkerPool::Shared().Cancel(work), napi_generic_failure);
+
+  work->cancelled = true;
+  env->enqueue_completion(WorkerPool::Complete, work);
+  return napi_ok;
+}
+
 // MARK: - Node+Threadsafe
 
 napi_status napi_create_threadsafe_function(napi_env env,
@@ -2909,96 +5565,248 @@ napi_status napi_create_threadsafe_function(napi_env env,
                                             void* context,
                                             napi_threadsafe_function_call_js call_js_cb,
                                             napi_threadsafe_function* result) {
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  RETURN_STATUS_IF_FALSE(env, initial_thread_count > 0, napi_invalid_arg);
+  if (call_js_cb == nullptr) {
+    CHECK_ARG(env, func);
+  }
+
   napi_threadsafe_function fn = new napi_threadsafe_function__{};
   fn->env = env;
-  fn->js_value = func;
+  if (func != nullptr) {
+    fn->js_value = ToJSValue(func);
+    JSValueProtect(env->context, fn->js_value);
+  }
   fn->refcount = initial_thread_count;
+  fn->max_queue_size = max_queue_size;
   fn->thread_finalize_data = thread_finalize_data;
   fn->thread_finalize_cb = thread_finalize_cb;
   fn->context = context;
   fn->call_js_cb = call_js_cb;
+  env->all_tsfns.insert(fn);
+  env->strong_tsfns.insert(fn);
   *result = fn;
   return napi_ok;
 }
 
 napi_status napi_get_threadsafe_function_context(napi_threadsafe_function func,
                                                  void** result) {
+  RECORD_CALL();
   if (!func) return napi_invalid_arg;
   *result = func->context;
   return napi_ok;
 }
 
+// Must be called with the function's mutex held.
+static bool is_unused(napi_threadsafe_function fn) {
+  return fn->finalized && fn->waiters == 0 && fn->dispatching == 0 && !fn->drain_scheduled;
+}
+
 // called on js thread
-void release_threadsafe_function(void *context) {
-  auto fn = static_cast<napi_threadsafe_function>(context);
-  fn->env->all_tsfns.erase(fn);
-  napi_unref_threadsafe_function(fn->env, fn);
-  fn->thread_finalize_cb(fn->env, fn->thread_finalize_data, nullptr);
-  delete fn;
+static void finalize_threadsafe_function(napi_threadsafe_function fn) {
+  napi_env env{fn->env};
+  env->all_tsfns.erase(fn);
+  if (fn->thread_finalize_cb != nullptr) {
+    fn->thread_finalize_cb(env, fn->thread_finalize_data, fn->context);
+  }
+  if (fn->js_value != nullptr) {
+    JSValueUnprotect(env->context, fn->js_value);
+  }
+  napi_unref_threadsafe_function(env, fn);
+  bool unused{};
+  {
+    std::lock_guard lock(fn->mutex);
+    fn->finalized = true;
+    unused = is_unused(fn);
+  }
+  if (unused) {
+    delete fn;
+  }
 }
 
-struct tsfn_call_context {
-  napi_threadsafe_function func;
-  void *data;
-};
+// Called on the js thread while the env is being deleted. Like
+// napi_tsfn_abort, except that queued calls and the finalizer run right away
+// rather than in a drain, which would come too late.
+static void abort_threadsafe_function(napi_threadsafe_function fn) {
+  std::vector<void*> queued;
+  {
+    std::unique_lock lock(fn->mutex);
+    fn->refcount = 0;
+    fn->aborted = true;
+    queued.swap(fn->queue);
+    fn->space_available.notify_all();
+    // Callers that are still handing a drain to the executor use the env.
+    fn->dispatched.wait(lock, [fn] { return fn->dispatching == 0; });
+  }
+  if (fn->call_js_cb != nullptr) {
+    // Lets the callback free `data` without calling into JS.
+    for (void* data : queued) {
+      fn->call_js_cb(nullptr, nullptr, fn->context, data);
+    }
+  }
+  finalize_threadsafe_function(fn);
+}
 
-// called inside env
-void _call_threadsafe_function(void *context) {
-  auto ctx_ptr = static_cast<tsfn_call_context *>(context);
-  auto ctx = *ctx_ptr;
-  delete ctx_ptr;
-  auto func = ctx.func;
-  if (func->js_value) {
-    napi_value undefined{};
-    napi_get_undefined(func->env, &undefined);
-    napi_call_function(func->env, undefined, func->js_value, 0, nullptr, nullptr);
-  } else {
-    func->call_js_cb(func->env, func->js_value, func->context, ctx.data);
+// Called after dispatching a drain, with the function's mutex released.
+static void end_dispatch(napi_threadsafe_function fn) {
+  bool unused{};
+  {
+    std::lock_guard lock(fn->mutex);
+    if (--fn->dispatching == 0) {
+      fn->dispatched.notify_all();
+    }
+    unused = is_unused(fn);
+  }
+  if (unused) {
+    delete fn;
+  }
+}
+
+// called on js thread
+static void drain_threadsafe_function(void *context) {
+  auto fn = static_cast<napi_threadsafe_function>(context);
+  bool closing{};
+  bool aborted{};
+  {
+    std::unique_lock lock(fn->mutex);
+    fn->drain_scheduled = false;
+    if (fn->finalized) {
+      // The env was deleted with this drain still scheduled.
+      bool unused{is_unused(fn)};
+      lock.unlock();
+      if (unused) {
+        delete fn;
+      }
+      return;
+    }
+    std::swap(fn->queue, fn->draining);
+    closing = fn->refcount == 0;
+    aborted = fn->aborted;
+  }
+  fn->space_available.notify_all();
+  napi_env__::task_scope scope{fn->env};
+
+  napi_env env{fn->env};
+  for (void* data : fn->draining) {
+    if (aborted) {
+      // Lets the callback free `data` without calling into JS.
+      if (fn->call_js_cb != nullptr) {
+        fn->call_js_cb(nullptr, nullptr, fn->context, data);
+      }
+    } else if (fn->call_js_cb != nullptr) {
+      fn->call_js_cb(env, ToNapi(fn->js_value), fn->context, data);
+    } else {
+      napi_value undefined{};
+      napi_get_undefined(env, &undefined);
+      napi_call_function(env, undefined, ToNapi(fn->js_value), 0, nullptr, nullptr);
+    }
+  }
+  fn->draining.clear();
+
+  // Nothing can be queued once the refcount reaches 0, so this is the last
+  // drain for the function.
+  if (closing) {
+    finalize_threadsafe_function(fn);
   }
 }
 
+// Must be called with the function's mutex held. Returns whether the caller
+// has to dispatch the drain, which it does after releasing the mutex so
+// that an executor running the task inline doesn't deadlock. Until the
+// drain runs the function can't be finalized.
+static bool schedule_drain(napi_threadsafe_function func) {
+  return !std::exchange(func->drain_scheduled, true);
+}
+
 napi_status napi_call_threadsafe_function(napi_threadsafe_function func,
                                           void* data,
                                           napi_threadsafe_function_call_mode is_blocking) {
-  func->env->executor.dispatch_async(func->env->executor.context,
-                                     _call_threadsafe_function,
-                                     new tsfn_call_context { func, data });
+  RECORD_CALL();
+  if (!func) return napi_invalid_arg;
+
+  std::unique_lock lock(func->mutex);
+  auto is_full = [func] {
+    return func->max_queue_size != 0 && func->queue.size() >= func->max_queue_size;
+  };
+  if (is_blocking == napi_tsfn_blocking && func->refcount != 0 && is_full()) {
+    ++func->waiters;
+    func->space_available.wait(lock, [&] { return func->refcount == 0 || !is_full(); });
+    --func->waiters;
+    if (func->finalized) {
+      bool unused{is_unused(func)};
+      lock.unlock();
+      if (unused) {
+        delete func;
+      }
+      return napi_closing;
+    }
+  }
+  if (func->refcount == 0) return napi_closing;
+  if (is_full()) return napi_queue_full;
+
+  func->queue.push_back(data);
+  bool dispatch{schedule_drain(func)};
+  if (dispatch) {
+    ++func->dispatching;
+  }
+  lock.unlock();
+  if (dispatch) {
+    func->env->dispatch(drain_threadsafe_function, func);
+    end_dispatch(func);
+  }
   return napi_ok;
 }
 
 napi_status napi_acquire_threadsafe_function(napi_threadsafe_function func) {
+  RECORD_CALL();
   std::lock_guard mutex(func->mutex);
-  if (func->refcount == -1) return napi_closing;
+  if (func->refcount == 0) return napi_closing;
   ++func->refcount;
   return napi_ok;
 }
 
 napi_status napi_release_threadsafe_function(napi_threadsafe_function func,
                                              napi_threadsafe_function_release_mode mode) {
-  bool closing = false;
-  do {
+  RECORD_CALL();
+  bool dispatch{};
+  {
     std::lock_guard mutex(func->mutex);
     if (func->refcount == 0) { // already closed
       return napi_closing;
     } else if (mode == napi_tsfn_abort) {
-      closing = true;
       func->refcount = 0;
-    } else if (--func->refcount == 0) {
-      closing = true;
+      func->aborted = true;
+    } else {
+      --func->refcount;
+    }
+    if (func->refcount == 0) {
+      // The drain finalizes the function once the queue is empty.
+      dispatch = schedule_drain(func);
+      if (dispatch) {
+        ++func->dispatching;
+      }
+      // Notified under the mutex, since the drain may delete the function
+      // as soon as it's released.
+      func->space_available.notify_all();
     }
-  } while (0);
-  if (closing) {
-    func->env->executor.dispatch_async(func->env->executor.context, release_threadsafe_function, func);
+  }
+  if (dispatch) {
+    func->env->dispatch(drain_threadsafe_function, func);
+    end_dispatch(func);
   }
   return napi_ok;
 }
 
 napi_status napi_ref_threadsafe_function(napi_env env, napi_threadsafe_function func) {
+  RECORD_CALL();
   env->strong_tsfns.insert(func);
   return napi_ok;
 }
 
 napi_status napi_unref_threadsafe_function(napi_env env, napi_threadsafe_function func) {
+  RECORD_CALL();
   auto it = env->strong_tsfns.find(func);
   if (it != env->strong_tsfns.end()) {
     env->strong_tsfns.erase(it);
@@ -3017,6 +5825,7 @@ const static napi_node_version node_api_version {
 };
 
 napi_status napi_get_node_version(napi_env env, const napi_node_version** version) {
+  RECORD_CALL();
   *version = &node_api_version;
   return napi_ok;
 }
@@ -3024,6 +5833,7 @@ napi_status napi_get_node_version(napi_env env, const napi_node_version** versio
 // MARK: - Node+Cleanup
 
 napi_status napi_add_env_cleanup_hook(napi_env env, napi_cleanup_hook fun, void* arg) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, fun);
   env->cleanup_hooks[fun].insert(arg);
@@ -3031,6 +5841,7 @@ napi_status napi_add_env_cleanup_hook(napi_env env, napi_cleanup_hook fun, void*
 }
 
 napi_status napi_remove_env_cleanup_hook(napi_env env, napi_cleanup_hook fun, void* arg) {
+  RECORD_CALL();
   CHECK_ENV(env);
   CHECK_ARG(env, fun);
   auto &set = env->cleanup_hooks[fun];
@@ -3054,11 +5865,49 @@ napi_status napi_remove_async_cleanup_hook(napi_async_cleanup_hook_handle remove
 
 // MARK: - Node+Buffer
 
+// Buffers are plain Uint8Arrays. Like Node's Buffer.allocUnsafe, buffers
+// smaller than half the pool size share a slab, so their contents start out
+// uninitialized.
 napi_status napi_create_buffer(napi_env env,
                                size_t length,
                                void** data,
                                napi_value* result) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+
+  napi_value arraybuffer{};
+  size_t byte_offset{};
+  if (length < napi_env__::buffer_pool_size / 2) {
+    if (env->buffer_pool == nullptr || env->buffer_pool_offset + length > napi_env__::buffer_pool_size) {
+      void* pool_data{};
+      napi_value pool{};
+      CHECK_NAPI(create_pooled_arraybuffer(env, napi_env__::buffer_pool_size, &pool_data, &pool));
+      if (env->buffer_pool != nullptr) {
+        JSValueUnprotect(env->context, env->buffer_pool);
+      }
+      env->buffer_pool = ToJSObject(env, pool);
+      JSValueProtect(env->context, env->buffer_pool);
+      env->buffer_pool_data = static_cast<uint8_t*>(pool_data);
+      env->buffer_pool_offset = 0;
+    }
+
+    arraybuffer = ToNapi(env->buffer_pool);
+    byte_offset = env->buffer_pool_offset;
+    // Keep the next buffer 8-byte aligned.
+    env->buffer_pool_offset = (byte_offset + length + 7) & ~size_t{7};
+    if (data != nullptr) {
+      *data = env->buffer_pool_data + byte_offset;
+    }
+  } else {
+    void* buffer_data{};
+    CHECK_NAPI(create_pooled_arraybuffer(env, length, &buffer_data, &arraybuffer));
+    if (data != nullptr) {
+      *data = buffer_data;
+    }
+  }
+
+  return napi_create_typedarray(env, napi_uint8_array, length, arraybuffer, byte_offset, result);
 }
 
 napi_status napi_create_external_buffer(napi_env env,
@@ -3067,7 +5916,13 @@ napi_status napi_create_external_buffer(napi_env env,
                                         napi_finalize finalize_cb,
                                         void* finalize_hint,
                                         napi_value* result) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+
+  napi_value arraybuffer{};
+  CHECK_NAPI(napi_create_external_arraybuffer(env, data, length, finalize_cb, finalize_hint, &arraybuffer));
+  return napi_create_typedarray(env, napi_uint8_array, length, arraybuffer, 0, result);
 }
 
 napi_status napi_create_buffer_copy(napi_env env,
@@ -3075,18 +5930,73 @@ napi_status napi_create_buffer_copy(napi_env env,
                                     const void* data,
                                     void** result_data,
                                     napi_value* result) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, result);
+  RETURN_STATUS_IF_FALSE(env, data != nullptr || length == 0, napi_invalid_arg);
+
+  void* buffer_data{};
+  CHECK_NAPI(napi_create_buffer(env, length, &buffer_data, result));
+  if (length != 0) {
+    std::memcpy(buffer_data, data, length);
+  }
+  if (result_data != nullptr) {
+    *result_data = buffer_data;
+  }
+  return napi_ok;
 }
 
+// Like Node, any ArrayBufferView counts as a buffer.
 napi_status napi_is_buffer(napi_env env,
                            napi_value value,
                            bool* result) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+  CHECK_ARG(env, result);
+
+  JSValueRef exception{};
+  JSTypedArrayType type{JSValueGetTypedArrayType(env->context, ToJSValue(value), &exception)};
+  CHECK_JSC(env, exception);
+  if (type != kJSTypedArrayTypeNone && type != kJSTypedArrayTypeArrayBuffer) {
+    *result = true;
+    return napi_ok;
+  }
+  return napi_is_dataview(env, value, result);
 }
 
 napi_status napi_get_buffer_info(napi_env env,
                                  napi_value value,
                                  void** data,
                                  size_t* length) {
-  throw std::runtime_error("unsupported");
+  RECORD_CALL();
+  CHECK_ENV(env);
+  CHECK_ARG(env, value);
+
+  JSValueRef exception{};
+  JSTypedArrayType type{JSValueGetTypedArrayType(env->context, ToJSValue(value), &exception)};
+  CHECK_JSC(env, exception);
+  if (type == kJSTypedArrayTypeNone || type == kJSTypedArrayTypeArrayBuffer) {
+    void* bytes{};
+    size_t byte_offset{};
+    CHECK_NAPI(napi_get_dataview_info(env, value, length, data != nullptr ? &bytes : nullptr, nullptr, &byte_offset));
+    if (data != nullptr) {
+      *data = static_cast<uint8_t*>(bytes) + byte_offset;
+    }
+    return napi_ok;
+  }
+
+  JSObjectRef object{ToJSObject(env, value)};
+  if (length != nullptr) {
+    *length = JSObjectGetTypedArrayByteLength(env->context, object, &exception);
+    CHECK_JSC(env, exception);
+  }
+  if (data != nullptr) {
+    size_t byte_offset{JSObjectGetTypedArrayByteOffset(env->context, object, &exception)};
+    CHECK_JSC(env, exception);
+    uint8_t* bytes{static_cast<uint8_t*>(JSObjectGetTypedArrayBytesPtr(env->context, object, &exception))};
+    CHECK_JSC(env, exception);
+    *data = bytes + byte_offset;
+  }
+  return napi_ok;
 }
@@ -74,6 +74,9 @@ public final class NodeArrayBuffer: NodeObject {
 
     #if !NAPI_VERSIONED || NAPI_GE_7
 
+    // On JSC, a buffer can't be detached once its bytes have been accessed
+    // from native code, e.g. through withUnsafeMutableBytes on it or on one
+    // of its views. This then throws detachableArraybufferExpected.
     public func detach() throws {
         try base.environment.check(
             napi_detach_arraybuffer(base.environment.raw, base.rawValue())
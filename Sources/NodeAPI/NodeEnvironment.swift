@@ -4,6 +4,8 @@ internal import CNodeAPI
 @NodeActor public final class NodeEnvironment {
     let _raw: UncheckedSendable<napi_env>
     nonisolated var raw: napi_env { _raw.value }
+    // for embedders like NodeJSC that extend the underlying napi_env
+    @_spi(NodeAPI) public nonisolated var rawEnvironment: OpaquePointer { raw }
 
     nonisolated init(_ raw: napi_env) {
         self._raw = .init(raw)
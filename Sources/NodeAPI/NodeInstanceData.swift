@@ -2,6 +2,56 @@ internal import CNodeAPI
 
 typealias InstanceDataBox = Box<[ObjectIdentifier: Any]>
 
+// Per-env storage that an embedder can offer in place of the process-wide
+// table below. NodeJSC installs one backed by a numbered instance data slot
+// of the JSC shim, so lookups skip the table's lock and
+// napi_set_instance_data stays free for the addon itself.
+//
+// Only envs that the embedder adopts when it creates them use the slot.
+// Every other env, including any created before the slot was installed,
+// keeps its data in the table, so an env's data never moves.
+@_spi(NodeAPI) public struct NodeInstanceDataSlot: Sendable {
+    public typealias Finalizer = @convention(c) (OpaquePointer?, UnsafeMutableRawPointer?, UnsafeMutableRawPointer?) -> Void
+
+    let get: @Sendable (OpaquePointer) -> UnsafeMutableRawPointer?
+    let set: @Sendable (OpaquePointer, UnsafeMutableRawPointer, Finalizer) -> Void
+
+    public init(
+        get: @escaping @Sendable (OpaquePointer) -> UnsafeMutableRawPointer?,
+        set: @escaping @Sendable (OpaquePointer, UnsafeMutableRawPointer, Finalizer) -> Void
+    ) {
+        self.get = get
+        self.set = set
+    }
+
+    private static let lock = Lock()
+    nonisolated(unsafe) private static var _current: NodeInstanceDataSlot?
+
+    static var current: NodeInstanceDataSlot? {
+        lock.withLock { _current }
+    }
+
+    // Only the first slot installed is used.
+    public static func install(_ slot: NodeInstanceDataSlot) {
+        lock.withLockVoid {
+            if _current == nil {
+                _current = slot
+            }
+        }
+    }
+
+    // Gives a newly created env its storage in the installed slot. Call this
+    // before anything else can look up the env's instance data.
+    public static func adopt(_ env: OpaquePointer) {
+        guard let slot = current else { return }
+        let box = InstanceDataBox([:])
+        // released when the env is deleted
+        slot.set(env, Unmanaged.passRetained(box).toOpaque()) { _, data, _ in
+            Unmanaged<InstanceDataBox>.fromOpaque(data!).release()
+        }
+    }
+}
+
 private class NodeInstanceDataStorage: @unchecked Sendable {
     private let lock = ReadWriteLock()
     private var storage: [napi_env: InstanceDataBox] = [:]
@@ -11,6 +61,9 @@ private class NodeInstanceDataStorage: @unchecked Sendable {
 
     @NodeActor func instanceData(for env: NodeEnvironment) -> InstanceDataBox {
         let raw = env.raw
+        if let data = NodeInstanceDataSlot.current?.get(raw) {
+            return Unmanaged<InstanceDataBox>.fromOpaque(data).takeUnretainedValue()
+        }
         return lock.withReaderLock {
             // fast path: in most cases, we should have storage
             // for the env already
@@ -40,6 +40,19 @@ public final class NodeString: NodePrimitive, NodeName, NodeValueCoercible {
     public func string() throws -> String {
         let env = base.environment
         let nodeVal = try base.rawValue()
+        // measuring in UTF-8 costs as much as converting, so short strings
+        // are converted once into a buffer big enough for any UTF-16 string
+        // of their length (at most 3 UTF-8 bytes per UTF-16 code unit)
+        var utf16Length: Int = 0
+        try env.check(napi_get_value_string_utf16(env.raw, nodeVal, nil, 0, &utf16Length))
+        if utf16Length <= 1024 {
+            let capacity = utf16Length * 3 + 1
+            return try withUnsafeTemporaryAllocation(of: CChar.self, capacity: capacity) { buf in
+                var length: Int = 0
+                try env.check(napi_get_value_string_utf8(env.raw, nodeVal, buf.baseAddress!, capacity, &length))
+                return String(decoding: UnsafeRawBufferPointer(start: buf.baseAddress!, count: length), as: UTF8.self)
+            }
+        }
         var length: Int = 0
         try env.check(napi_get_value_string_utf8(env.raw, nodeVal, nil, 0, &length))
         // napi nul-terminates strings
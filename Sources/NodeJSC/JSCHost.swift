@@ -0,0 +1,166 @@
+import CNodeJSC
+import Foundation
+@_spi(NodeAPI) import NodeAPI
+
+// Runs a fixed set of independent JSC environments, each with its own
+// JSContextGroup (and so its own VM and heap) on its own thread. Requests go
+// to whichever environment has the fewest outstanding, so CPU-bound JS
+// scales with the number of environments.
+//
+// Environments don't share any JS state, so a request shouldn't assume that
+// it lands on the same environment as a previous one.
+public final class JSCHost: @unchecked Sendable {
+    private let environments: [HostedEnvironment]
+
+    private let lock = NSLock()
+    // requests submitted to each environment that haven't completed yet
+    private var outstanding: [Int]
+
+    public init(environments count: Int = ProcessInfo.processInfo.activeProcessorCount) {
+        precondition(count > 0, "JSCHost needs at least one environment")
+        environments = (0..<count).map { HostedEnvironment(index: $0) }
+        outstanding = Array(repeating: 0, count: count)
+    }
+
+    public var environmentCount: Int { environments.count }
+
+    public func run<T: Sendable>(_ body: @NodeActor @Sendable @escaping () throws -> T) async throws -> T {
+        lock.lock()
+        let index = outstanding.indices.min { outstanding[$0] < outstanding[$1] }!
+        outstanding[index] += 1
+        lock.unlock()
+        defer {
+            lock.lock()
+            outstanding[index] -= 1
+            lock.unlock()
+        }
+        return try await environments[index].run(body)
+    }
+}
+
+extension JSCHost {
+    // Thrown by run when the environment couldn't set up a context for the
+    // body, which then never ran.
+    public struct EnvironmentUnavailableError: Error {}
+}
+
+private final class HostedEnvironment: @unchecked Sendable {
+    // Holds the env for closures that outlive self. Only touched on the
+    // executor's thread.
+    private final class Raw: @unchecked Sendable {
+        var env: OpaquePointer?
+    }
+
+    private let executor: ThreadExecutor
+    private let raw = Raw()
+
+    init(index: Int) {
+        executor = ThreadExecutor(name: "JSCHost environment \(index)")
+        executor.submit { [executor, raw] in
+            // JSGlobalContextCreate puts each context in a group of its own
+            let context = JSGlobalContextCreate(nil)!
+            raw.env = napi_env_jsc_create_v2(context, executor.napiExecutor())
+            JSGlobalContextRelease(context)
+            if let env = raw.env {
+                JSCInstanceData.adopt(env)
+            }
+        }
+    }
+
+    deinit {
+        // The env may only go away after finalizers and other deferred work
+        // have run on the thread, so the executor keeps running until the
+        // env frees it. See ThreadExecutor.napiExecutor.
+        executor.submit { [executor, raw] in
+            if let env = raw.env {
+                raw.env = nil
+                napi_env_jsc_delete(env)
+            } else {
+                executor.stop()
+            }
+        }
+    }
+
+    func run<T: Sendable>(_ body: @NodeActor @Sendable @escaping () throws -> T) async throws -> T {
+        try await withCheckedThrowingContinuation { continuation in
+            executor.submit { [raw] in
+                let result = raw.env.flatMap { env in
+                    NodeEnvironment.performUnsafe(env) {
+                        Result { try body() }
+                    }
+                }
+                continuation.resume(with: result ?? .failure(JSCHost.EnvironmentUnavailableError()))
+            }
+        }
+    }
+}
+
+// A serial executor with a dedicated thread. Each wakeup runs everything
+// that's been submitted since the last one.
+private final class ThreadExecutor: @unchecked Sendable {
+    private let condition = NSCondition()
+    private var pending: [() -> Void] = []
+    private var stopped = false
+
+    init(name: String) {
+        let thread = Thread { [self] in loop() }
+        thread.name = name
+        thread.start()
+    }
+
+    func submit(_ task: @escaping () -> Void) {
+        condition.lock()
+        pending.append(task)
+        condition.signal()
+        condition.unlock()
+    }
+
+    func stop() {
+        condition.lock()
+        stopped = true
+        condition.signal()
+        condition.unlock()
+    }
+
+    private func loop() {
+        var running: [() -> Void] = []
+        while true {
+            condition.lock()
+            while pending.isEmpty && !stopped {
+                condition.wait()
+            }
+            if pending.isEmpty {
+                condition.unlock()
+                return
+            }
+            swap(&pending, &running)
+            condition.unlock()
+            for task in running {
+                task()
+            }
+            running.removeAll(keepingCapacity: true)
+        }
+    }
+
+    func napiExecutor() -> napi_executor_v2 {
+        napi_executor_v2(
+            version: 2,
+            context: Unmanaged.passRetained(self).toOpaque(),
+            // the env is gone, so nothing else will be submitted
+            free: { Unmanaged<ThreadExecutor>.fromOpaque($0!).takeRetainedValue().stop() },
+            assert_current: { _ in },
+            dispatch_async: { ctx, cb, arg in
+                Unmanaged<ThreadExecutor>.fromOpaque(ctx!).takeUnretainedValue().submit { cb?(arg) }
+            },
+            dispatch_batch: { ctx, tasks, count in
+                let batch = Array(UnsafeBufferPointer(start: tasks, count: count))
+                Unmanaged<ThreadExecutor>.fromOpaque(ctx!).takeUnretainedValue().submit {
+                    for task in batch {
+                        task.fn?(task.arg)
+                    }
+                }
+            },
+            drain_microtasks: nil
+        )
+    }
+}
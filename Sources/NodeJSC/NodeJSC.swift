@@ -1,5 +1,6 @@
 import CNodeJSC
-import NodeAPI
+import Foundation
+@_spi(NodeAPI) import NodeAPI
 
 extension NodeEnvironment {
     public nonisolated static func withJSC<R>(
@@ -7,19 +8,248 @@ extension NodeEnvironment {
         _ perform: @NodeActor @Sendable () throws -> R
     ) -> R? {
         let context = context ?? JSContext()!
-        let executor = napi_executor(
-            version: 1,
-            context: nil,
-            free: { _ in },
-            assert_current: { _ in },
-            dispatch_async: { _, cb, ctx in
-                let sendable = UncheckedSendable(ctx)
-                DispatchQueue.main.async { cb?(sendable.value) }
-            }
-        )
-        let raw = napi_env_jsc_create(context.jsGlobalContextRef, executor)!
+        let raw = napi_env_jsc_create_v2(context.jsGlobalContextRef, MainQueueExecutor.make())!
+        JSCInstanceData.adopt(raw)
         return performUnsafe(raw) {
             try perform()
         }
     }
+
+    // Runs perform in a new env with a context from pool, then deletes the
+    // env once nothing keeps it alive.
+    public nonisolated static func withJSC<R>(
+        pool: JSCContextPool,
+        _ perform: @NodeActor @Sendable () throws -> R
+    ) -> R? {
+        let raw = napi_env_jsc_create_pooled(pool.raw, MainQueueExecutor.make())!
+        JSCInstanceData.adopt(raw)
+        defer { napi_env_jsc_delete(raw) }
+        return performUnsafe(raw) {
+            try perform()
+        }
+    }
+}
+
+// Keeps NodeAPI's per-env data in a numbered slot rather than in
+// napi_set_instance_data, which belongs to the addon. Envs created through
+// NodeJSC are adopted into the slot as soon as they exist. Any other env
+// keeps using NodeAPI's own table.
+enum JSCInstanceData {
+    private static let installed: Void = {
+        var claimed: UInt32 = 0
+        guard napi_jsc_claim_instance_data_slot(&claimed) else { return }
+        let slot = claimed
+        NodeInstanceDataSlot.install(NodeInstanceDataSlot(
+            get: { napi_env_jsc_get_instance_data_slot($0, slot) },
+            set: { env, data, finalize in
+                let set = napi_env_jsc_set_instance_data_slot(env, slot, data, finalize, nil)
+                precondition(set, "Could not set instance data")
+            }
+        ))
+    }()
+
+    // Call right after creating env, on its thread.
+    static func adopt(_ env: OpaquePointer) {
+        _ = installed
+        NodeInstanceDataSlot.adopt(env)
+    }
+}
+
+// Contexts sharing a JSContextGroup for hosts that create many short-lived
+// environments. See napi_jsc_context_pool in embedder.h.
+public final class JSCContextPool: @unchecked Sendable {
+    public struct Stats: Sendable {
+        public let environmentsCreated: Int
+        public let environmentsDeleted: Int
+        public let spareContexts: Int
+        public let meanCreationNanoseconds: Int
+        public let maxCreationNanoseconds: Int
+        // spare contexts created by the pool's own thread
+        public let contextsReplenished: Int
+        public let meanReplenishNanoseconds: Int
+        public let maxReplenishNanoseconds: Int
+    }
+
+    let raw: napi_jsc_context_pool
+
+    public init(spareContexts: Int = 4) {
+        raw = napi_jsc_context_pool_create(spareContexts)
+    }
+
+    deinit {
+        napi_jsc_context_pool_release(raw)
+    }
+
+    // contexts created in this group share a VM with the pool's
+    public var group: JSContextGroupRef {
+        napi_jsc_context_pool_get_group(raw)
+    }
+
+    public var stats: Stats {
+        var stats = napi_jsc_context_pool_stats()
+        napi_jsc_context_pool_get_stats(raw, &stats)
+        return Stats(
+            environmentsCreated: Int(stats.envs_created),
+            environmentsDeleted: Int(stats.envs_deleted),
+            spareContexts: stats.spare_contexts,
+            meanCreationNanoseconds: Int(stats.mean_creation_ns),
+            maxCreationNanoseconds: Int(stats.max_creation_ns),
+            contextsReplenished: Int(stats.contexts_replenished),
+            meanReplenishNanoseconds: Int(stats.mean_replenish_ns),
+            maxReplenishNanoseconds: Int(stats.max_replenish_ns)
+        )
+    }
+}
+
+// Runs everything that's been dispatched since the last hop in one main
+// queue hop, rather than one hop per task.
+private final class MainQueueExecutor: @unchecked Sendable {
+    private let lock = NSLock()
+    private var pending: [napi_executor_task] = []
+    private var running: [napi_executor_task] = []
+
+    static func make() -> napi_executor_v2 {
+        napi_executor_v2(
+            version: 2,
+            context: Unmanaged.passRetained(MainQueueExecutor()).toOpaque(),
+            free: { Unmanaged<MainQueueExecutor>.fromOpaque($0!).release() },
+            assert_current: { _ in },
+            dispatch_async: { ctx, cb, arg in
+                var task = napi_executor_task(fn: cb, arg: arg)
+                Unmanaged<MainQueueExecutor>.fromOpaque(ctx!).takeUnretainedValue().enqueue(&task, count: 1)
+            },
+            dispatch_batch: { ctx, tasks, count in
+                Unmanaged<MainQueueExecutor>.fromOpaque(ctx!).takeUnretainedValue().enqueue(tasks!, count: count)
+            },
+            drain_microtasks: nil
+        )
+    }
+
+    func enqueue(_ tasks: UnsafePointer<napi_executor_task>, count: Int) {
+        lock.lock()
+        let schedule = pending.isEmpty
+        pending.append(contentsOf: UnsafeBufferPointer(start: tasks, count: count))
+        lock.unlock()
+        if schedule {
+            DispatchQueue.main.async { self.drain() }
+        }
+    }
+
+    private func drain() {
+        lock.lock()
+        swap(&pending, &running)
+        lock.unlock()
+        for task in running {
+            task.fn?(task.arg)
+        }
+        running.removeAll(keepingCapacity: true)
+    }
+}
+
+extension NodeEnvironment {
+    // threads shared by every environment for napi_queue_async_work
+    public nonisolated static var jscAsyncWorkThreads: Int {
+        napi_jsc_async_work_threads()
+    }
+
+    public struct JSCScriptCacheStats: Sendable {
+        public let hits: Int
+        public let misses: Int
+        // scripts currently cached
+        public let count: Int
+    }
+
+    // counters for the compiled-script cache behind run(script:). Only valid
+    // for environments created with withJSC.
+    public var jscScriptCacheStats: JSCScriptCacheStats {
+        var stats = napi_jsc_script_cache_stats()
+        napi_env_jsc_get_script_cache_stats(rawEnvironment, &stats)
+        return JSCScriptCacheStats(hits: Int(stats.hits), misses: Int(stats.misses), count: stats.count)
+    }
+
+    public struct JSCPropertyKeyStats: Sendable {
+        // found by the address of the name
+        public let pointerHits: Int
+        // found by the content of the name
+        public let nameHits: Int
+        public let misses: Int
+        // keys currently cached
+        public let count: Int
+    }
+
+    // counters for the cache of property names passed to the C API as
+    // strings. Only valid for environments created with withJSC.
+    public var jscPropertyKeyStats: JSCPropertyKeyStats {
+        var stats = napi_jsc_property_key_stats()
+        napi_env_jsc_get_property_key_stats(rawEnvironment, &stats)
+        return JSCPropertyKeyStats(
+            pointerHits: Int(stats.pointer_hits),
+            nameHits: Int(stats.name_hits),
+            misses: Int(stats.misses),
+            count: stats.count
+        )
+    }
+
+    public struct JSCCallStats: Sendable {
+        // the C function, e.g. napi_get_named_property
+        public let name: String
+        public let calls: Int
+        public let totalNanoseconds: Int
+        // histogram[n] counts calls that took between 2^n and 2^(n+1) ns
+        public let histogram: [Int]
+    }
+
+    // call counts and latencies for each Node-API function, across every
+    // environment and thread. Empty unless CNodeJSC was built with
+    // NAPI_JSC_STATS=1.
+    public nonisolated static var jscCallStats: [JSCCallStats] {
+        var entries = [napi_jsc_call_stats](repeating: napi_jsc_call_stats(), count: 256)
+        let count = napi_jsc_get_call_stats(&entries, entries.count)
+        return entries.prefix(min(count, entries.count)).map { entry in
+            JSCCallStats(
+                name: String(cString: entry.name),
+                calls: Int(entry.calls),
+                totalNanoseconds: Int(entry.total_ns),
+                histogram: withUnsafeBytes(of: entry.histogram) { Array($0.bindMemory(to: UInt64.self)).map { Int($0) } }
+            )
+        }
+    }
+
+    public struct JSCArrayBufferPoolStats: Sendable {
+        public let hits: Int
+        public let misses: Int
+        // freed backing stores waiting for reuse
+        public let bytesCached: Int
+    }
+
+    public struct JSCMemoryStats: Sendable {
+        public let creationNanoseconds: Int
+        // as reported through adjustExternalMemory
+        public let externalMemory: Int
+        public let refTableBytes: Int
+        public let strongRefs: Int
+        public let arrayBufferPoolBytes: Int
+    }
+
+    // native memory held by the environment. The JS heap is shared between
+    // contexts in a group and isn't included.
+    public var jscMemoryStats: JSCMemoryStats {
+        var stats = napi_jsc_env_memory_stats()
+        napi_env_jsc_get_memory_stats(rawEnvironment, &stats)
+        return JSCMemoryStats(
+            creationNanoseconds: Int(stats.creation_ns),
+            externalMemory: Int(stats.external_memory),
+            refTableBytes: stats.ref_table_bytes,
+            strongRefs: stats.strong_refs,
+            arrayBufferPoolBytes: stats.arraybuffer_pool_bytes
+        )
+    }
+
+    // counters for the pool that backs ArrayBuffers and Buffers created from
+    // Swift. Only valid for environments created with withJSC.
+    public var jscArrayBufferPoolStats: JSCArrayBufferPoolStats {
+        var stats = napi_jsc_arraybuffer_pool_stats()
+        napi_env_jsc_get_arraybuffer_pool_stats(rawEnvironment, &stats)
+        return JSCArrayBufferPoolStats(hits: Int(stats.hits), misses: Int(stats.misses), bytesCached: stats.bytes_cached)
+    }
 }
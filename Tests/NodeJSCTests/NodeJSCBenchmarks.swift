@@ -0,0 +1,309 @@
+@testable import NodeAPI
+import CNodeAPI
+import NodeJSC
+import XCTest
+
+// Throughput benchmarks for hot paths in the JSC shim. These print their
+// results rather than asserting on them; compare runs across revisions to
+// evaluate a change.
+extension NodeJSCTests {
+    @NodeActor func testBenchmarkObjectCreation() async throws {
+        try Node.withUnmanagedContext {
+            try benchmark("NodeFunction creation", iterations: 20_000) {
+                _ = try NodeFunction { _ in }
+            }
+            try benchmark("NodeExternal creation", iterations: 20_000) {
+                _ = try NodeExternal(value: 0)
+            }
+            let key = NodeWrappedDataKey<Int>()
+            try benchmark("NodeObject wrap", iterations: 20_000) {
+                try NodeObject().setWrappedValue(0, forKey: key)
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkClassDefinition() async throws {
+        let properties = NodeClassPropertyList((0..<50).map { i -> (NodeName, NodeClassPropertyConvertible) in
+            ("method\(i)", NodeMethod { _ in })
+        })
+        try Node.withUnmanagedContext {
+            try benchmark("Class definition (50 methods)", iterations: 500) {
+                _ = try NodeFunction(className: "Benchmark", properties: properties) { _ in }
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkReferences() async throws {
+        try Node.withUnmanagedContext {
+            try benchmark("Reference creation", iterations: 20_000) {
+                try NodeObject().persist()
+            }
+            try benchmark("Finalizer registration", iterations: 20_000) {
+                try NodeObject().addFinalizer {}
+            }
+        }
+        await sut.debugGC()
+    }
+
+    @NodeActor func testBenchmarkBigInt() async throws {
+        try Node.withUnmanagedContext {
+            var id: Int64 = 1 << 62
+            try benchmark("BigInt int64 round trip", iterations: 50_000) {
+                id &+= 1
+                _ = try NodeBigInt(signed: id).signed()
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkStringCreation() async throws {
+        let payloads = [
+            ("ASCII", String(repeating: "The quick brown fox. ", count: 8)),
+            ("Latin-1", String(repeating: "Café déjà vu, señor. ", count: 8)),
+            ("CJK", String(repeating: "素早い茶色の狐が怠惰な犬を飛び越える。", count: 8)),
+        ]
+        try Node.withUnmanagedContext {
+            for (label, payload) in payloads {
+                try benchmark("NodeString creation (\(label), \(payload.utf8.count) bytes)", iterations: 50_000) {
+                    _ = try NodeString(payload)
+                }
+            }
+            try benchmark("Dynamic property get", iterations: 50_000) {
+                _ = try Node.global.undefinedPropertyName.nodeValue()
+            }
+            for (label, payload) in payloads {
+                let string = try NodeString(payload)
+                try benchmark("NodeString.string() (\(label), \(payload.utf8.count) bytes)", iterations: 50_000) {
+                    _ = try string.string()
+                }
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkSmallBuffers() async throws {
+        let message = Data(repeating: 0x2A, count: 64)
+        try Node.withUnmanagedContext {
+            try benchmark("NodeBuffer allocation (64 bytes)", iterations: 100_000) {
+                _ = try NodeBuffer(capacity: 64)
+            }
+            try benchmark("Data.nodeValue (64 bytes)", iterations: 100_000) {
+                _ = try message.nodeValue()
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkArrayBufferChurn() async throws {
+        let sizes = [64, 256, 1024, 4096, 16384]
+        for round in 0..<4 {
+            try Node.withUnmanagedContext {
+                var i = 0
+                try benchmark("NodeArrayBuffer churn, round \(round) (64B-16KB)", iterations: 50_000) {
+                    i += 1
+                    _ = try NodeArrayBuffer(capacity: sizes[i % sizes.count])
+                }
+            }
+            // returns this round's backing stores to the pool
+            await sut.debugGC()
+        }
+        let stats = Node.jscArrayBufferPoolStats
+        print("""
+        [benchmark] ArrayBuffer pool: \(stats.hits) hits, \(stats.misses) misses, \
+        \(stats.bytesCached) bytes cached
+        """)
+    }
+
+    @NodeActor func testBenchmarkAsyncQueue() async throws {
+        let producers = 8
+        let callsPerProducer = 25_000
+        let total = producers * callsPerProducer
+        let queue = try NodeAsyncQueue(label: "benchmark", maxQueueSize: 4096)
+        let latencies = LatencyRecorder(capacity: total)
+
+        let start = DispatchTime.now().uptimeNanoseconds
+        await withCheckedContinuation { (continuation: CheckedContinuation<Void, Never>) in
+            DispatchQueue.global().async {
+                DispatchQueue.concurrentPerform(iterations: producers) { _ in
+                    for _ in 0..<callsPerProducer {
+                        let sent = DispatchTime.now().uptimeNanoseconds
+                        try? queue.run(blocking: true) {
+                            latencies.record(DispatchTime.now().uptimeNanoseconds - sent)
+                            if latencies.count == total {
+                                continuation.resume()
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        let elapsed = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+
+        let sorted = latencies.samples.sorted()
+        func percentile(_ p: Double) -> Double {
+            Double(sorted[min(sorted.count - 1, Int(Double(sorted.count) * p))]) / 1e3
+        }
+        print("""
+        [benchmark] NodeAsyncQueue (\(producers) producers): \(Int(Double(total) / elapsed)) calls/s, \
+        latency p50 \(percentile(0.5))µs p99 \(percentile(0.99))µs p99.9 \(percentile(0.999))µs
+        """)
+    }
+
+    @NodeActor func testBenchmarkAsyncWork() async throws {
+        // With one job per core, ideal scaling keeps the elapsed time flat.
+        let cores = ProcessInfo.processInfo.activeProcessorCount
+        var jobs = 1
+        while true {
+            jobs = min(jobs, cores)
+            let start = DispatchTime.now().uptimeNanoseconds
+            await AsyncWorkBatch().run(jobs: jobs, in: Node)
+            let elapsed = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+            print("[benchmark] Async work (\(jobs) jobs, \(cores) cores): \(Int(Double(jobs) / elapsed)) jobs/s in \(elapsed)s")
+            if jobs == cores { break }
+            jobs *= 2
+        }
+    }
+
+    @NodeActor func testBenchmarkEnvironmentChurn() async throws {
+        let pool = JSCContextPool(spareContexts: 8)
+        benchmark("Pooled environment create + run + delete", iterations: 10_000) {
+            _ = NodeEnvironment.withJSC(pool: pool) {
+                _ = try Node.run(script: "[1, 2, 3].map(x => x * 2)")
+            }
+        }
+        // lets deferred deletions run
+        await Task.yield()
+        let stats = pool.stats
+        print("""
+        [benchmark] Context pool: \(stats.environmentsCreated) created, \(stats.environmentsDeleted) deleted, \
+        creation mean \(Double(stats.meanCreationNanoseconds) / 1e3)µs max \(Double(stats.maxCreationNanoseconds) / 1e3)µs, \
+        \(stats.contextsReplenished) replenished off the JS thread, \
+        mean \(Double(stats.meanReplenishNanoseconds) / 1e3)µs max \(Double(stats.maxReplenishNanoseconds) / 1e3)µs
+        """)
+    }
+
+    func testBenchmarkHostScaling() async throws {
+        // CPU-bound JS, so throughput should grow roughly linearly with
+        // environments until they outnumber cores.
+        let cores = ProcessInfo.processInfo.activeProcessorCount
+        var environments = 1
+        while true {
+            environments = min(environments, cores)
+            let host = JSCHost(environments: environments)
+            let requests = environments * 8
+            let start = DispatchTime.now().uptimeNanoseconds
+            try await withThrowingTaskGroup(of: Int?.self) { group in
+                for _ in 0..<requests {
+                    group.addTask {
+                        try await host.run {
+                            try Node.run(script: """
+                            (function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2) })(25)
+                            """).as(Int.self)
+                        }
+                    }
+                }
+                for try await result in group {
+                    XCTAssertEqual(result, 75025)
+                }
+            }
+            let elapsed = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+            print("[benchmark] JSCHost (\(environments) envs, \(cores) cores): \(Int(Double(requests) / elapsed)) requests/s")
+            if environments == cores { break }
+            environments *= 2
+        }
+    }
+
+    @NodeActor func testBenchmarkPropertyNames() async throws {
+        try Node.withUnmanagedContext {
+            let object = try XCTUnwrap(Node.run(script: """
+            Object.fromEntries(Array.from({ length: 1000 }, (_, i) => [`key${i}`, i]))
+            """).as(NodeObject.self))
+            try benchmark("Dictionary.from (1000 keys)", iterations: 200) {
+                _ = try [String: NodeValue].from(object)
+            }
+            try benchmark("Own property names (1000 keys)", iterations: 200) {
+                _ = try object.propertyNames(collectionMode: .ownOnly, filter: .allProperties, conversion: .keepNumbers)
+            }
+        }
+    }
+
+    @NodeActor func testBenchmarkPromiseCreation() async throws {
+        try Node.withUnmanagedContext {
+            try benchmark("Promise create + resolve", iterations: 20_000) {
+                let deferred = try NodePromise.Deferred()
+                try deferred(.success(undefined))
+            }
+        }
+    }
+}
+
+// Fans out CPU-bound jobs through napi_queue_async_work.
+private final class AsyncWorkBatch: @unchecked Sendable {
+    private var remaining = 0
+    private var continuation: CheckedContinuation<Void, Never>?
+    private var works: [napi_async_work?] = []
+    // Where jobs leave their results, so that their loops aren't optimized
+    // away.
+    private let sinkLock = NSLock()
+    private var sink: UInt64 = 0
+
+    @NodeActor func run(jobs: Int, in env: NodeEnvironment) async {
+        remaining = jobs
+        await withCheckedContinuation { continuation in
+            self.continuation = continuation
+            let data = Unmanaged.passUnretained(self).toOpaque()
+            for _ in 0..<jobs {
+                var work: napi_async_work?
+                napi_create_async_work(env.raw, nil, nil, { _, data in
+                    var x: UInt64 = 1
+                    for i in 0..<20_000_000 { x = x &* 6364136223846793005 &+ UInt64(i) }
+                    Unmanaged<AsyncWorkBatch>.fromOpaque(data!).takeUnretainedValue().consume(x)
+                }, { env, _, data in
+                    let batch = Unmanaged<AsyncWorkBatch>.fromOpaque(data!).takeUnretainedValue()
+                    batch.remaining -= 1
+                    if batch.remaining == 0 {
+                        batch.continuation?.resume()
+                    }
+                }, data, &work)
+                napi_queue_async_work(env.raw, work)
+                works.append(work)
+            }
+        }
+        for work in works {
+            napi_delete_async_work(env.raw, work)
+        }
+    }
+
+    // Called on worker threads.
+    private func consume(_ result: UInt64) {
+        sinkLock.lock()
+        sink ^= result
+        sinkLock.unlock()
+    }
+}
+
+// Only touched on the JS thread.
+private final class LatencyRecorder: @unchecked Sendable {
+    private(set) var samples: [UInt64] = []
+
+    init(capacity: Int) {
+        samples.reserveCapacity(capacity)
+    }
+
+    var count: Int { samples.count }
+
+    func record(_ nanoseconds: UInt64) {
+        samples.append(nanoseconds)
+    }
+}
+
+@NodeActor func benchmark(
+    _ label: String,
+    iterations: Int,
+    _ body: () throws -> Void
+) rethrows {
+    let start = DispatchTime.now().uptimeNanoseconds
+    for _ in 0..<iterations {
+        try body()
+    }
+    let elapsed = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+    let rate = Double(iterations) / elapsed
+    print("[benchmark] \(label): \(Int(rate)) ops/s (\(iterations) iterations in \(elapsed)s)")
+}
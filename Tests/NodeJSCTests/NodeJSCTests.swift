@@ -1,11 +1,13 @@
-@testable import NodeAPI
+@_spi(NodeAPI) @testable import NodeAPI
+import CNodeAPI
+import CNodeJSC
 import NodeJSC
 import XCTest
 import JavaScriptCore
 
 final class NodeJSCTests: XCTestCase {
     private let sutBox = Box<JSContext?>(nil)
-    private var sut: JSContext { sutBox.value! }
+    var sut: JSContext { sutBox.value! }
 
     override func invokeTest() {
         var global: JSManagedValue?
@@ -60,6 +62,204 @@ final class NodeJSCTests: XCTestCase {
         XCTAssertFalse(finalized)
     }
 
+    @NodeActor func testFinalizerOnFrozenObject() async throws {
+        var finalized = false
+        try autoreleasepool {
+            let frozen = try XCTUnwrap(Node.run(script: """
+            globalThis.frozen = Object.seal(Object.freeze({}))
+            """).as(NodeObject.self))
+            try frozen.addFinalizer {
+                finalized = true
+            }
+        }
+        XCTAssertEqual(try Node.run(script: "Reflect.ownKeys(frozen).length").as(Int.self), 0)
+        try Node.run(script: "frozen = null")
+        await sut.debugGC()
+        XCTAssert(finalized)
+    }
+
+    @NodeActor func testAdjustExternalMemory() async throws {
+        let baseline = try Node.adjustExternalMemory(byBytes: 0)
+        XCTAssertEqual(try Node.adjustExternalMemory(byBytes: 8 << 20), baseline + (8 << 20))
+        XCTAssertEqual(try Node.adjustExternalMemory(byBytes: -(8 << 20)), baseline)
+        _ = try NodeArrayBuffer(data: NSMutableData(length: 8 << 20)!)
+        XCTAssertEqual(try Node.adjustExternalMemory(byBytes: 0), baseline)
+        XCTAssertEqual(Node.jscMemoryStats.externalMemory, Int(baseline))
+    }
+
+    @NodeActor func testExternalMemoryBoundsResidentSize() async throws {
+        // 4GB of native memory churned through small wrappers. Nothing but
+        // the reported external memory prompts the GC to collect them.
+        let chunk = 16 << 20
+        let env = Node.raw
+        let start = residentBytes()
+        var peak = start
+        for _ in 0..<256 {
+            try autoreleasepool {
+                let bytes = malloc(chunk)!
+                memset(bytes, 1, chunk)
+                try NodeObject().addFinalizer {
+                    free(bytes)
+                    var adjusted: Int64 = 0
+                    napi_adjust_external_memory(env, -Int64(chunk), &adjusted)
+                }
+                try Node.adjustExternalMemory(byBytes: Int64(chunk))
+            }
+            peak = max(peak, residentBytes())
+            // lets the finalizers of collected wrappers run
+            await Task.yield()
+        }
+        XCTAssertLessThan(peak - start, 1 << 30)
+    }
+
+    @NodeActor func testInstanceData() async throws {
+        let key1 = NodeInstanceDataKey<String>()
+        let key2 = NodeInstanceDataKey<Int>()
+        XCTAssertNil(Node[key1])
+        Node[key1] = "One"
+        Node[key2] = 2
+        XCTAssertEqual(Node[key1], "One")
+        XCTAssertEqual(Node[key2], 2)
+        Node[key1] = nil
+        XCTAssertNil(Node[key1])
+    }
+
+    @NodeActor func testInstanceDataSlots() async throws {
+        let slot = try XCTUnwrap(Self.instanceDataSlot)
+        XCTAssertNotEqual(slot, 0)
+        let data = UnsafeMutableRawPointer(bitPattern: 0x10)!
+        XCTAssertNil(napi_env_jsc_get_instance_data_slot(Node.raw, slot))
+        XCTAssertTrue(napi_env_jsc_set_instance_data_slot(Node.raw, slot, data, nil, nil))
+        XCTAssertEqual(napi_env_jsc_get_instance_data_slot(Node.raw, slot), data)
+        XCTAssertTrue(napi_env_jsc_set_instance_data_slot(Node.raw, slot, nil, nil, nil))
+
+        // slot 0 is napi_set_instance_data's
+        let outOfRange = UInt32(NAPI_JSC_INSTANCE_DATA_SLOTS)
+        XCTAssertFalse(napi_env_jsc_set_instance_data_slot(Node.raw, 0, data, nil, nil))
+        XCTAssertFalse(napi_env_jsc_set_instance_data_slot(Node.raw, outOfRange, data, nil, nil))
+        XCTAssertNil(napi_env_jsc_get_instance_data_slot(Node.raw, 0))
+        XCTAssertNil(napi_env_jsc_get_instance_data_slot(Node.raw, outOfRange))
+
+        // NodeInstanceData leaves napi_set_instance_data to the addon
+        Node[NodeInstanceDataKey<Int>()] = 1
+        var instanceData: UnsafeMutableRawPointer?
+        XCTAssertEqual(napi_get_instance_data(Node.raw, &instanceData), napi_ok)
+        XCTAssertNil(instanceData)
+    }
+
+    @NodeActor func testInstanceDataOfEnvNotCreatedByNodeJSC() async throws {
+        // keeps its data in NodeAPI's own table even though the slot is
+        // installed
+        let context = JSGlobalContextCreate(nil)!
+        defer { JSGlobalContextRelease(context) }
+        let executor = napi_executor(
+            version: 1,
+            context: nil,
+            free: { _ in },
+            assert_current: { _ in },
+            dispatch_async: { _, cb, arg in
+                let task = UncheckedSendable((cb, arg))
+                DispatchQueue.main.async { task.value.0?(task.value.1) }
+            }
+        )
+        let env = try XCTUnwrap(napi_env_jsc_create(context, executor))
+        nonisolated(unsafe) let key = NodeInstanceDataKey<Int>()
+        let value = NodeEnvironment.performUnsafe(env) {
+            Node[key] = 42
+            return Node[key]
+        }
+        XCTAssertEqual(value, 42)
+        XCTAssertEqual(NodeEnvironment.performUnsafe(env) { Node[key] }, 42)
+        napi_env_jsc_delete(env)
+    }
+
+    @NodeActor func testInstanceDataSlotsFinalizedOnDelete() async throws {
+        let slot = try XCTUnwrap(Self.instanceDataSlot)
+        nonisolated(unsafe) let finalizations = Box(0)
+        nonisolated(unsafe) weak var stored: Box<Int>?
+        let pool = JSCContextPool(spareContexts: 1)
+        let set = NodeEnvironment.withJSC(pool: pool) {
+            let value = Box(0)
+            stored = value
+            Node[NodeInstanceDataKey<Box<Int>>()] = value
+            return napi_env_jsc_set_instance_data_slot(
+                Node.raw, slot, Unmanaged.passRetained(finalizations).toOpaque(),
+                { _, data, _ in Unmanaged<Box<Int>>.fromOpaque(data!).takeRetainedValue().value += 1 },
+                nil
+            )
+        }
+        XCTAssertEqual(set, true)
+        // lets the deferred deletion run
+        await Task.yield()
+        XCTAssertEqual(pool.stats.environmentsDeleted, 1)
+        XCTAssertEqual(finalizations.value, 1)
+        XCTAssertNil(stored)
+    }
+
+    private static let instanceDataSlot: UInt32? = {
+        var slot: UInt32 = 0
+        return napi_jsc_claim_instance_data_slot(&slot) ? slot : nil
+    }()
+
+    @NodeActor func testPooledEnvironmentTeardown() async throws {
+        let pool = JSCContextPool(spareContexts: 2)
+        XCTAssertEqual(pool.stats.spareContexts, 2)
+        for _ in 0..<3 {
+            let result = NodeEnvironment.withJSC(pool: pool) {
+                try Node.run(script: "globalThis.leak = (globalThis.leak ?? 0) + 1").as(Int.self)
+            }
+            // every env gets a fresh global object
+            XCTAssertEqual(result, 1)
+        }
+        await Task.yield()
+        // spares are replaced on the pool's thread
+        let deadline = Date().addingTimeInterval(1)
+        while pool.stats.spareContexts < 2 && Date() < deadline {
+            try await Task.sleep(nanoseconds: 1_000_000)
+        }
+        let stats = pool.stats
+        XCTAssertEqual(stats.environmentsCreated, 3)
+        XCTAssertEqual(stats.environmentsDeleted, 3)
+        XCTAssertEqual(stats.spareContexts, 2)
+        XCTAssertGreaterThanOrEqual(stats.contextsReplenished, 2)
+        XCTAssertGreaterThan(stats.meanReplenishNanoseconds, 0)
+    }
+
+    @NodeActor func testPooledEnvironmentDeletedWithLiveObjects() async throws {
+        nonisolated(unsafe) var finalized = false
+        nonisolated(unsafe) var queue: NodeAsyncQueue?
+        let wrapFinalized = Box(false)
+        let native = UncheckedSendable(Unmanaged.passUnretained(wrapFinalized).toOpaque())
+        let pool = JSCContextPool(spareContexts: 1)
+        let result: Void? = NodeEnvironment.withJSC(pool: pool) {
+            // still reachable from the global object when the env is deleted
+            let object = try XCTUnwrap(Node.run(script: "globalThis.leftover = {}").as(NodeObject.self))
+            try object.addFinalizer { finalized = true }
+            XCTAssertEqual(napi_wrap(Node.raw, object.rawValue(), native.value, { _, data, _ in
+                Unmanaged<Box<Bool>>.fromOpaque(data!).takeUnretainedValue().value = true
+            }, nil, nil), napi_ok)
+            // unref'd, so it doesn't keep the env alive
+            queue = try NodeAsyncQueue(label: "leftover")
+        }
+        XCTAssertNotNil(result)
+        await Task.yield()
+        XCTAssertEqual(pool.stats.environmentsDeleted, 1)
+        // run when the env was deleted rather than when the object is collected
+        XCTAssertTrue(finalized)
+        XCTAssertTrue(wrapFinalized.value)
+        XCTAssertThrowsError(try XCTUnwrap(queue).run {})
+
+        finalized = false
+        wrapFinalized.value = false
+        // collects the object with a context that shares the pool's VM
+        let raw = JSGlobalContextCreateInGroup(pool.group, nil)
+        defer { JSGlobalContextRelease(raw) }
+        let context = try XCTUnwrap(JSContext(jsGlobalContextRef: raw))
+        await context.debugGC()
+        XCTAssertFalse(finalized)
+        XCTAssertFalse(wrapFinalized.value)
+    }
+
     @NodeActor func testWrappedValue() async throws {
         let key1 = NodeWrappedDataKey<String>()
         let key2 = NodeWrappedDataKey<Int>()
@@ -71,6 +271,29 @@ final class NodeJSCTests: XCTestCase {
         XCTAssertEqual(try object.wrappedValue(forKey: key2), 2)
     }
 
+    @NodeActor func testWrapLeavesObjectAlone() async throws {
+        let object = try XCTUnwrap(Node.run(script: """
+        globalThis.traps = 0
+        globalThis.wrapped = new Proxy(Object.freeze({}), { get() { traps++ } })
+        """).as(NodeObject.self)).rawValue()
+        let native = UnsafeMutableRawPointer(bitPattern: 0x1234)
+        XCTAssertEqual(napi_wrap(Node.raw, object, native, nil, nil, nil), napi_ok)
+        var unwrapped: UnsafeMutableRawPointer?
+        XCTAssertEqual(napi_unwrap(Node.raw, object, &unwrapped), napi_ok)
+        XCTAssertEqual(unwrapped, native)
+        XCTAssertEqual(
+            try Node.run(script: "Reflect.ownKeys(wrapped).length + traps").as(Int.self),
+            0
+        )
+        var names: napi_value?
+        XCTAssertEqual(napi_get_all_property_names(
+            Node.raw, object, napi_key_own_only, napi_key_all_properties, napi_key_keep_numbers, &names
+        ), napi_ok)
+        var count: UInt32 = 1
+        XCTAssertEqual(napi_get_array_length(Node.raw, names, &count), napi_ok)
+        XCTAssertEqual(count, 0)
+    }
+
     @NodeActor func testWrappedValueDeinit() async throws {
         weak var value: NSObject?
         var objectRef: NodeObject?
@@ -106,6 +329,450 @@ final class NodeJSCTests: XCTestCase {
         XCTAssertTrue(finalized2)
     }
 
+    @NodeActor func testNativeFunctionsAndClasses() async throws {
+        try Node.fn.set(to: NodeFunction(name: "hello") { _ in 42 })
+        let fnResult = try Node.run(script: "[typeof fn, fn.name, fn.call(null), fn instanceof Function].join()")
+        XCTAssertEqual(try fnResult.as(String.self), "function,hello,42,true")
+
+        try Node.MyClass.set(to: MyClass.constructor())
+        try Node.obj.set(to: MyClass {})
+        let classResult = try Node.run(script: "[obj instanceof MyClass, ({}) instanceof MyClass, obj.constructor === MyClass].join()")
+        XCTAssertEqual(try classResult.as(String.self), "true,false,true")
+    }
+
+    @NodeActor func testPropertyNameFilters() async throws {
+        let obj = try XCTUnwrap(Node.run(script: """
+        const obj = Object.create({ own: 0, inherited: 1 })
+        obj.own = 1
+        obj[2] = 2
+        Object.defineProperty(obj, "hidden", { value: 3, enumerable: false })
+        obj[Symbol.iterator] = 4
+        obj
+        """).as(NodeObject.self))
+
+        func describe(_ keys: NodeArray) throws -> String? {
+            try Node.keys.set(to: keys)
+            return try Node.run(script: """
+            keys.map(k => typeof k === "symbol" ? "symbol" : `${typeof k}:${k}`).join()
+            """).as(String.self)
+        }
+
+        XCTAssertEqual(
+            try describe(obj.propertyNames(collectionMode: .ownOnly, filter: .allProperties, conversion: .keepNumbers)),
+            "number:2,string:own,string:hidden,symbol"
+        )
+        XCTAssertEqual(
+            try describe(obj.propertyNames(collectionMode: .includePrototypes, filter: [.enumerable, .skipSymbols], conversion: .numbersToStrings)),
+            "string:2,string:own,string:inherited"
+        )
+        XCTAssertEqual(
+            try describe(obj.propertyNames(collectionMode: .ownOnly, filter: [.writable, .skipStrings], conversion: .numbersToStrings)),
+            "symbol"
+        )
+        XCTAssertEqual(try Dictionary.from(obj).keys.sorted(), ["2", "inherited", "own"])
+
+        // non-enumerable own keys still hide inherited ones
+        let shadowing = try XCTUnwrap(Node.run(script: """
+        const shadowing = Object.create({ a: 1, b: 2 })
+        Object.defineProperty(shadowing, "a", { value: 0, enumerable: false })
+        shadowing
+        """).as(NodeObject.self))
+        XCTAssertEqual(
+            try describe(shadowing.propertyNames(collectionMode: .includePrototypes, filter: [.enumerable, .skipSymbols], conversion: .numbersToStrings)),
+            "string:b"
+        )
+
+        let large = try XCTUnwrap(Node.run(script: """
+        Object.fromEntries(Array.from({ length: 2000 }, (_, i) => [`key${i}`, i]))
+        """).as(NodeObject.self))
+        let names = try large.propertyNames(collectionMode: .includePrototypes, filter: [.enumerable, .skipSymbols], conversion: .numbersToStrings)
+        XCTAssertEqual(try names.count(), 2000)
+        XCTAssertEqual(try names[1999].as(String.self), "key1999")
+    }
+
+    @NodeActor func testDefineProperties() async throws {
+        let object = try NodeObject()
+        try object.define(NodeObjectPropertyList([
+            ("a", NodeProperty(get: { _ in 1 })),
+            ("b", NodePropertyBase(2)),
+            ("c", NodeProperty(get: { _ in 3 })),
+            ("b", NodePropertyBase(attributes: .enumerable, 4)),
+        ]))
+        try Node.defined.set(to: object)
+        XCTAssertEqual(
+            try Node.run(script: "Object.keys(defined).join() + ':' + defined.b").as(String.self),
+            "a,b,c:4"
+        )
+
+        let frozen = try XCTUnwrap(Node.run(script: "Object.freeze({})").as(NodeObject.self))
+        XCTAssertThrowsError(try frozen.define(["x": NodePropertyBase(1)]))
+    }
+
+    @NodeActor func testScriptCache() async throws {
+        let before = Node.jscScriptCacheStats
+        for i in 0..<10 {
+            try Node.counter.set(to: i)
+            XCTAssertEqual(try Node.run(script: "counter * 2").as(Int.self), i * 2)
+        }
+        let after = Node.jscScriptCacheStats
+        XCTAssertEqual(after.misses - before.misses, 1)
+        XCTAssertEqual(after.hits - before.hits, 9)
+
+        let beforeError = Node.jscScriptCacheStats
+        let source = "let ok = 1\nsyntax error("
+        var thrown: NodeError?
+        XCTAssertThrowsError(try Node.run(script: source)) { error in
+            thrown = try? (error as? AnyNodeValue)?.as(NodeError.self)
+        }
+        // the same error the engine throws for the source
+        try Node.source.set(to: source)
+        let expected = try XCTUnwrap(Node.run(script: """
+        (() => { try { (0, eval)(source) } catch (e) { return e } })()
+        """).as(NodeError.self))
+        let error = try XCTUnwrap(thrown)
+        XCTAssertEqual(try error.name.as(String.self), "SyntaxError")
+        XCTAssertEqual(try error.message.as(String.self), try expected.message.as(String.self))
+        XCTAssertEqual(try error.line.as(Int.self), try expected.line.as(Int.self))
+        // scripts that don't parse aren't cached
+        XCTAssertEqual(Node.jscScriptCacheStats.count, beforeError.count)
+    }
+
+    @NodeActor func testPropertyKeyCache() async throws {
+        let name: StaticString = "cachedKey"
+        let key = UnsafeRawPointer(name.utf8Start).assumingMemoryBound(to: CChar.self)
+        let node = try NodeObject()
+        let object = try node.rawValue()
+        let before = Node.jscPropertyKeyStats
+        for i in 0..<10 {
+            XCTAssertEqual(napi_set_named_property(Node.raw, object, key, try i.rawValue()), napi_ok)
+            var value: napi_value?
+            var result: Int32 = -1
+            XCTAssertEqual(napi_get_named_property(Node.raw, object, key, &value), napi_ok)
+            XCTAssertEqual(napi_get_value_int32(Node.raw, value, &result), napi_ok)
+            XCTAssertEqual(result, Int32(i))
+        }
+        XCTAssertEqual(try node.cachedKey.as(Int.self), 9)
+        let after = Node.jscPropertyKeyStats
+        XCTAssertEqual(after.misses - before.misses, 1)
+        XCTAssertEqual(after.pointerHits - before.pointerHits, 19)
+
+        // same name at a different address
+        let copy = strdup("cachedKey")!
+        defer { free(copy) }
+        var has = false
+        XCTAssertEqual(napi_has_named_property(Node.raw, object, copy, &has), napi_ok)
+        XCTAssertTrue(has)
+        XCTAssertEqual(Node.jscPropertyKeyStats.nameHits - after.nameHits, 1)
+
+        var value: napi_value?
+        XCTAssertEqual(napi_set_named_property(Node.raw, object, nil, try 0.rawValue()), napi_invalid_arg)
+        XCTAssertEqual(napi_set_named_property(Node.raw, nil, key, try 0.rawValue()), napi_invalid_arg)
+        XCTAssertEqual(napi_has_named_property(Node.raw, object, nil, &has), napi_invalid_arg)
+        XCTAssertEqual(napi_has_named_property(Node.raw, object, key, nil), napi_invalid_arg)
+        XCTAssertEqual(napi_get_named_property(Node.raw, object, nil, &value), napi_invalid_arg)
+        XCTAssertEqual(napi_get_named_property(Node.raw, object, key, nil), napi_invalid_arg)
+    }
+
+    @NodeActor func testPropertyKeyEvictedDuringLookup() async throws {
+        // a getter that looks up more names than the cache holds, evicting
+        // the key it was reached through
+        try Node.churn.set(to: NodeFunction { _ in
+            let target = try NodeObject().rawValue()
+            for i in 0..<1024 {
+                let name = strdup("churn\(i)")!
+                defer { free(name) }
+                XCTAssertEqual(napi_set_named_property(Node.raw, target, name, try i.rawValue()), napi_ok)
+            }
+            return 42
+        })
+        let object = try XCTUnwrap(Node.run(script: """
+        ({ get outerKey() { return churn() }, set outerKey(value) { churn(); this.stored = value } })
+        """).as(NodeObject.self))
+        let raw = try object.rawValue()
+        let key = strdup("outerKey")!
+        defer { free(key) }
+
+        var value: napi_value?
+        XCTAssertEqual(napi_get_named_property(Node.raw, raw, key, &value), napi_ok)
+        XCTAssertEqual(try AnyNodeValue(raw: XCTUnwrap(value)).as(Int.self), 42)
+        XCTAssertEqual(napi_set_named_property(Node.raw, raw, key, try 7.rawValue()), napi_ok)
+        XCTAssertEqual(try object.stored.as(Int.self), 7)
+        var has = false
+        XCTAssertEqual(napi_has_named_property(Node.raw, raw, key, &has), napi_ok)
+        XCTAssertTrue(has)
+    }
+
+    @NodeActor func testCallStats() async throws {
+        _ = try NodeObject()
+        let stats = NodeEnvironment.jscCallStats
+        #if NAPI_JSC_STATS
+        XCTAssertFalse(stats.isEmpty)
+        #else
+        // only populated when the shim is built with NAPI_JSC_STATS=1
+        try XCTSkipIf(stats.isEmpty, "run with NAPI_JSC_STATS=1 swift test")
+        #endif
+        let createObject = try XCTUnwrap(stats.first { $0.name == "napi_create_object" })
+        XCTAssertGreaterThan(createObject.calls, 0)
+        XCTAssertEqual(createObject.histogram.reduce(0, +), createObject.calls)
+    }
+
+    @NodeActor func testStringCreation() async throws {
+        for string in ["", "ascii only", "café", "日本語", "😀 emoji", String(repeating: "aé日😀", count: 100)] {
+            XCTAssertEqual(try NodeString(string).string(), string)
+        }
+        // invalid UTF-8 is replaced the same way with or without a length
+        let invalid: [CChar] = [0x61, -1, 0x62, 0]
+        for length in [-1, 3] {
+            var value: napi_value?
+            XCTAssertEqual(napi_create_string_utf8(Node.raw, invalid, length, &value), napi_ok)
+            XCTAssertEqual(try AnyNodeValue(raw: XCTUnwrap(value)).as(String.self), "a\u{FFFD}b")
+        }
+        // embedded nulls survive the ASCII path
+        XCTAssertEqual(try NodeString("a\0b").string(), "a\0b")
+
+        // long enough to be measured before it's copied, which reuses the
+        // measured string
+        let long = String(repeating: "déjà vu ", count: 500)
+        let value = try NodeString(long)
+        XCTAssertEqual(try value.string(), long)
+        XCTAssertEqual(try value.string(), long)
+        XCTAssertEqual(try NodeString(String(repeating: "x", count: 2000)).string(), String(repeating: "x", count: 2000))
+    }
+
+    @NodeActor func testPropertyKeys() async throws {
+        // NAPI_AUTO_LENGTH
+        let autoLength = -1
+        let object = try NodeObject()
+        var key: napi_value?
+        func roundTrip(_ expected: String) throws {
+            XCTAssertEqual(try AnyNodeValue(raw: XCTUnwrap(key)).as(String.self), expected)
+            XCTAssertEqual(napi_set_property(Node.raw, try object.rawValue(), key, try expected.rawValue()), napi_ok)
+            XCTAssertEqual(try object[expected].as(String.self), expected)
+        }
+
+        // ASCII names are interned, others fall back to plain strings
+        for name in ["latin1Key", "clé"] {
+            let latin1 = name.unicodeScalars.map { CChar(bitPattern: UInt8($0.value)) }
+            XCTAssertEqual(node_api_create_property_key_latin1(Node.raw, latin1, latin1.count, &key), napi_ok)
+            try roundTrip(name)
+        }
+        for name in ["utf8Key", "ключ 🔑"] {
+            XCTAssertEqual(node_api_create_property_key_utf8(Node.raw, name, autoLength, &key), napi_ok)
+            try roundTrip(name)
+        }
+        for name in ["utf16Key", "ключ 🔑", "lone \u{FFFD}"] {
+            var utf16 = Array(name.utf16)
+            if name.hasPrefix("lone") {
+                utf16[utf16.count - 1] = 0xD800
+            }
+            XCTAssertEqual(node_api_create_property_key_utf16(Node.raw, utf16, utf16.count, &key), napi_ok)
+            if name.hasPrefix("lone") {
+                var length = 0
+                XCTAssertEqual(napi_get_value_string_utf16(Node.raw, key, nil, 0, &length), napi_ok)
+                XCTAssertEqual(length, utf16.count)
+            } else {
+                try roundTrip(name)
+            }
+        }
+
+        // a null name is only valid when it's empty
+        XCTAssertEqual(node_api_create_property_key_latin1(Node.raw, nil, 0, &key), napi_ok)
+        try roundTrip("")
+        XCTAssertEqual(node_api_create_property_key_latin1(Node.raw, nil, 1, &key), napi_invalid_arg)
+        XCTAssertEqual(node_api_create_property_key_utf8(Node.raw, nil, autoLength, &key), napi_invalid_arg)
+        XCTAssertEqual(node_api_create_property_key_utf16(Node.raw, nil, autoLength, &key), napi_invalid_arg)
+    }
+
+    @NodeActor func testStringCopyBounds() async throws {
+        let value = try NodeString("héllo").rawValue()
+        var buf = [CChar](repeating: 0x7F, count: 8)
+        var length = -1
+
+        // a bufsize of 0 writes nothing, not even the terminator
+        XCTAssertEqual(napi_get_value_string_utf8(Node.raw, value, &buf, 0, &length), napi_ok)
+        XCTAssertEqual(length, 0)
+        XCTAssertEqual(buf[0], 0x7F)
+
+        // truncation keeps whole characters: "h" fits in 2 bytes, "hé" doesn't
+        XCTAssertEqual(napi_get_value_string_utf8(Node.raw, value, &buf, 3, &length), napi_ok)
+        XCTAssertEqual(length, 1)
+        XCTAssertEqual(Array(buf[0..<3]), [0x68, 0, 0x7F])
+
+        // Latin-1 copies truncate to bufsize - 1 and terminate
+        buf = [CChar](repeating: 0x7F, count: 8)
+        XCTAssertEqual(napi_get_value_string_latin1(Node.raw, value, &buf, 3, &length), napi_ok)
+        XCTAssertEqual(length, 2)
+        XCTAssertEqual(buf[0..<4].map { UInt8(bitPattern: $0) }, [0x68, 0xE9, 0, 0x7F])
+
+        XCTAssertEqual(napi_get_value_string_latin1(Node.raw, value, &buf, 8, &length), napi_ok)
+        XCTAssertEqual(length, 5)
+        XCTAssertEqual(buf[5], 0)
+        XCTAssertEqual(napi_get_value_string_latin1(Node.raw, value, nil, 0, &length), napi_ok)
+        XCTAssertEqual(length, 5)
+    }
+
+    @NodeActor func testExternalStrings() async throws {
+        let finalizations = Box(0)
+        let hint = Unmanaged.passUnretained(finalizations).toOpaque()
+        let finalize: napi_finalize = { _, _, hint in
+            Unmanaged<Box<Int>>.fromOpaque(hint!).takeUnretainedValue().value += 1
+        }
+        var result: napi_value?
+        var copied = false
+
+        // ASCII is kept in 8-bit storage, the rest is widened
+        for (index, text) in ["plain ASCII", "café déjà vu"].enumerated() {
+            var latin1 = text.unicodeScalars.map { CChar(bitPattern: UInt8($0.value)) }
+            copied = false
+            XCTAssertEqual(node_api_create_external_string_latin1(
+                Node.raw, &latin1, latin1.count, finalize, hint, &result, &copied
+            ), napi_ok)
+            XCTAssertTrue(copied)
+            // the string is a copy, so the buffer is finalized before returning
+            XCTAssertEqual(finalizations.value, index + 1)
+            latin1 = latin1.map { _ in 0 }
+            XCTAssertEqual(try AnyNodeValue(raw: XCTUnwrap(result)).as(String.self), text)
+        }
+
+        var utf16 = Array("素早い 🦊".utf16)
+        copied = false
+        XCTAssertEqual(node_api_create_external_string_utf16(
+            Node.raw, &utf16, utf16.count, finalize, hint, &result, &copied
+        ), napi_ok)
+        XCTAssertTrue(copied)
+        XCTAssertEqual(finalizations.value, 3)
+        XCTAssertEqual(try AnyNodeValue(raw: XCTUnwrap(result)).as(String.self), "素早い 🦊")
+    }
+
+    @NodeActor func testBuffer() async throws {
+        // small buffers share a pool slab but must not overlap
+        let a = try Data("hello".utf8).nodeValue()
+        let b = try Data("world!".utf8).nodeValue()
+        try Node.a.set(to: a)
+        try Node.b.set(to: b)
+        XCTAssertEqual(
+            try Node.run(script: "String.fromCharCode(...a) + ' ' + String.fromCharCode(...b) + ' ' + (a instanceof Uint8Array)")
+                .as(String.self),
+            "hello world! true"
+        )
+        XCTAssertEqual(try Data.from(XCTUnwrap(b.as(NodeTypedArray<UInt8>.self))), Data("world!".utf8))
+        XCTAssertNotNil(try b.as(NodeBuffer.self))
+
+        let large = try NodeBuffer(capacity: 64 << 10)
+        XCTAssertEqual(try large.data().count, 64 << 10)
+        XCTAssertNil(try Node.run(script: "new ArrayBuffer(1)").as(NodeBuffer.self))
+    }
+
+    @NodeActor func testDetachArrayBuffer() async throws {
+        nonisolated(unsafe) var deallocations = 0
+        let bytes = UnsafeMutableRawBufferPointer.allocate(byteCount: 1024, alignment: 16)
+        let buffer = try NodeArrayBuffer(bytes: bytes, deallocator: .init { bytes in
+            deallocations += 1
+            bytes.deallocate()
+        })
+        try Node.buf.set(to: buffer)
+        try Node.run(script: "view = new Uint8Array(buf)")
+        XCTAssertFalse(try buffer.isDetached())
+
+        try buffer.detach()
+        XCTAssertTrue(try buffer.isDetached())
+        XCTAssertEqual(try buffer.withUnsafeMutableBytes { $0.count }, 0)
+        XCTAssertEqual(try Node.run(script: "buf.byteLength + view.length").as(Int.self), 0)
+
+        await sut.debugGC()
+        XCTAssertEqual(deallocations, 1)
+        await sut.debugGC()
+        XCTAssertEqual(deallocations, 1)
+
+        XCTAssertFalse(try NodeArrayBuffer(capacity: 8).isDetached())
+    }
+
+    @NodeActor func testDetachNonArrayBuffer() async throws {
+        let buffer = NodeArrayBuffer(try NodeObject().base)
+        XCTAssertThrowsError(try buffer.detach()) { error in
+            let error = error as? NodeAPIError
+            XCTAssertEqual(error?.code, .arraybufferExpected)
+            XCTAssertEqual(error?.details?.message, "An arraybuffer was expected")
+        }
+    }
+
+    @NodeActor func testDetachPinnedArrayBuffer() async throws {
+        let buffer = try NodeArrayBuffer(capacity: 1024)
+        let raw = try buffer.rawValue()
+        // pins the backing store
+        var data: UnsafeMutableRawPointer?
+        var length = 0
+        XCTAssertEqual(napi_get_arraybuffer_info(Node.raw, raw, &data, &length), napi_ok)
+        XCTAssertEqual(length, 1024)
+
+        XCTAssertEqual(napi_detach_arraybuffer(Node.raw, raw), napi_detachable_arraybuffer_expected)
+        XCTAssertFalse(try buffer.isDetached())
+        XCTAssertThrowsError(try buffer.detach()) { error in
+            XCTAssertEqual((error as? NodeAPIError)?.code, .detachableArraybufferExpected)
+        }
+        XCTAssertEqual(try buffer.withUnsafeMutableBytes { $0.count }, 1024)
+    }
+
+    @NodeActor func testAsyncWorkCancellation() async throws {
+        // One more job than there are worker threads, so that exactly one is
+        // still queued while the rest block.
+        let threads = NodeEnvironment.jscAsyncWorkThreads
+        let context = BlockingWork()
+        let data = Unmanaged.passUnretained(context).toOpaque()
+        var works: [napi_async_work?] = []
+        for _ in 0...threads {
+            var work: napi_async_work?
+            napi_create_async_work(Node.raw, nil, nil, { _, data in
+                let context = Unmanaged<BlockingWork>.fromOpaque(data!).takeUnretainedValue()
+                context.started.signal()
+                context.release.wait()
+            }, { _, status, data in
+                Unmanaged<BlockingWork>.fromOpaque(data!).takeUnretainedValue().statuses.append(status)
+            }, data, &work)
+            XCTAssertEqual(napi_queue_async_work(Node.raw, work), napi_ok)
+            works.append(work)
+        }
+        for _ in 0..<threads {
+            context.started.wait()
+        }
+
+        let cancelled = works.filter { napi_cancel_async_work(Node.raw, $0) == napi_ok }
+        XCTAssertEqual(cancelled.count, 1)
+        for _ in 0..<threads {
+            context.release.signal()
+        }
+        while context.statuses.count < works.count {
+            await Task.yield()
+        }
+        XCTAssertEqual(context.statuses.filter { $0 == napi_cancelled }.count, 1)
+        XCTAssertEqual(context.statuses.filter { $0 == napi_ok }.count, threads)
+        for work in works {
+            XCTAssertEqual(napi_delete_async_work(Node.raw, work), napi_ok)
+        }
+    }
+
+    @NodeActor func testBigInt() async throws {
+        let min = try NodeBigInt(signed: .min)
+        XCTAssertEqual(try min.signed().value, .min)
+        XCTAssertTrue(try min.signed().lossless)
+        XCTAssertFalse(try min.unsigned().lossless)
+
+        let max = try NodeBigInt(unsigned: .max)
+        XCTAssertEqual(try max.unsigned().value, .max)
+        XCTAssertEqual(try max.signed().value, -1)
+        XCTAssertFalse(try max.signed().lossless)
+
+        let words: [UInt64] = [0x0123_4567_89AB_CDEF, 0, 42]
+        let big = try NodeBigInt(sign: .negative, words: words)
+        XCTAssertEqual(try big.words().words, words)
+        XCTAssertEqual(try big.words().sign, .negative)
+        XCTAssertEqual(try NodeBigInt(sign: .positive, words: []).words().words, [])
+
+        try Node.big.set(to: big)
+        let string = try Node.run(script: "typeof big + ':' + big.toString(16)")
+        XCTAssertEqual(try string.as(String.self), "bigint:-2a00000000000000000123456789abcdef")
+    }
+
     @NodeActor func testPromise() async throws {
         try Node.tick.set(to: NodeFunction { _ in
             await Task.yield()
@@ -163,3 +830,54 @@ final class NodeJSCTests: XCTestCase {
 
     deinit { onDeinit() }
 }
+
+private final class BlockingWork: @unchecked Sendable {
+    let started = DispatchSemaphore(value: 0)
+    let release = DispatchSemaphore(value: 0)
+    // only touched on the JS thread
+    var statuses: [napi_status] = []
+}
+
+// Experimental or missing in the vendored headers, so Swift can't see them.
+private func residentBytes() -> Int {
+    var info = mach_task_basic_info()
+    var count = mach_msg_type_number_t(MemoryLayout<mach_task_basic_info>.size / MemoryLayout<natural_t>.size)
+    let result = withUnsafeMutablePointer(to: &info) {
+        $0.withMemoryRebound(to: integer_t.self, capacity: Int(count)) {
+            task_info(mach_task_self_, task_flavor_t(MACH_TASK_BASIC_INFO), $0, &count)
+        }
+    }
+    return result == KERN_SUCCESS ? Int(info.resident_size) : 0
+}
+
+@_silgen_name("node_api_create_external_string_latin1")
+private func node_api_create_external_string_latin1(
+    _ env: OpaquePointer?, _ str: UnsafeMutablePointer<CChar>?, _ length: Int,
+    _ finalize: napi_finalize?, _ hint: UnsafeMutableRawPointer?,
+    _ result: UnsafeMutablePointer<napi_value?>?, _ copied: UnsafeMutablePointer<Bool>?
+) -> napi_status
+
+@_silgen_name("node_api_create_external_string_utf16")
+private func node_api_create_external_string_utf16(
+    _ env: OpaquePointer?, _ str: UnsafeMutablePointer<UInt16>?, _ length: Int,
+    _ finalize: napi_finalize?, _ hint: UnsafeMutableRawPointer?,
+    _ result: UnsafeMutablePointer<napi_value?>?, _ copied: UnsafeMutablePointer<Bool>?
+) -> napi_status
+
+@_silgen_name("node_api_create_property_key_latin1")
+private func node_api_create_property_key_latin1(
+    _ env: OpaquePointer?, _ str: UnsafePointer<CChar>?, _ length: Int,
+    _ result: UnsafeMutablePointer<napi_value?>?
+) -> napi_status
+
+@_silgen_name("node_api_create_property_key_utf8")
+private func node_api_create_property_key_utf8(
+    _ env: OpaquePointer?, _ str: UnsafePointer<CChar>?, _ length: Int,
+    _ result: UnsafeMutablePointer<napi_value?>?
+) -> napi_status
+
+@_silgen_name("node_api_create_property_key_utf16")
+private func node_api_create_property_key_utf16(
+    _ env: OpaquePointer?, _ str: UnsafePointer<UInt16>?, _ length: Int,
+    _ result: UnsafeMutablePointer<napi_value?>?
+) -> napi_status